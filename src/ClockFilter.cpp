@@ -0,0 +1,31 @@
+#include "ClockFilter.h"
+#include <math.h>
+
+unsigned int selectClockFilterSample (const NTPSample_t* samples, unsigned int numSamples, int64_t now) {
+    unsigned int selected = 0;
+    int64_t minDistance = INT64_MAX;
+
+    for (unsigned int i = 0; i < numSamples; i++) {
+        const NTPSample_t* sample = &(samples[i]);
+        int64_t distance = sample->delay / 2 + sample->dispersion + (now - sample->time) * CLOCK_FILTER_PHI / 1000;
+        if (distance < minDistance) {
+            minDistance = distance;
+            selected = i;
+        }
+    }
+    return selected;
+}
+
+int64_t clockFilterJitter (const NTPSample_t* samples, unsigned int numSamples, unsigned int selected, int64_t correction) {
+    double squares = 0;
+
+    if (numSamples < 2) {
+        return 0;
+    }
+    int64_t reference = clockFilterOffset (&(samples[selected]), correction);
+    for (unsigned int i = 0; i < numSamples; i++) {
+        double difference = (double)(clockFilterOffset (&(samples[i]), correction) - reference);
+        squares += difference * difference;
+    }
+    return (int64_t)sqrt (squares / (numSamples - 1));
+}
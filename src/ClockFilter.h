@@ -0,0 +1,58 @@
+/**
+  * @file ClockFilter.h
+  * @version 0.2.6
+  * @date 29/12/2021
+  * @author German Martin
+  * @brief RFC5905 clock filter. Selects best offset sample from the last ones got from a server
+  */
+
+#ifndef _ClockFilter_h
+#define _ClockFilter_h
+
+#include <stdint.h>
+
+constexpr auto CLOCK_FILTER_SIZE = 8; ///< @brief Number of samples kept by clock filter
+constexpr auto CLOCK_FILTER_PHI = 15; ///< @brief Frequency tolerance used to age clock filter samples, in ppm
+
+  /**
+    * @brief Offset sample kept by clock filter
+    */
+typedef struct {
+    int64_t offset;                 ///< @brief Measured offset, in nanoseconds
+    int64_t delay;                  ///< @brief Measured round trip delay, in nanoseconds
+    int64_t dispersion;             ///< @brief Sample dispersion, in nanoseconds
+    int64_t time;                   ///< @brief Monotonic time when sample was got, in microseconds
+    int64_t correction;             ///< @brief Total correction applied by library on clock when sample was got, in microseconds
+} NTPSample_t;
+
+  /**
+    * @brief Gets offset of a sample referred to current clock. Corrections applied since sample was got,
+    * either stepped or slewed, are subtracted from it
+    * @param sample Sample
+    * @param correction Total correction applied by library on clock now, in microseconds
+    * @return Offset in nanoseconds
+    */
+inline int64_t clockFilterOffset (const NTPSample_t* sample, int64_t correction) {
+    return sample->offset - (correction - sample->correction) * 1000;
+}
+
+  /**
+    * @brief Selects sample with minimum synchronization distance. Dispersion of older samples grows with their age
+    * @param samples Samples, newest first
+    * @param numSamples Number of samples. It must be over 0
+    * @param now Monotonic time, in microseconds
+    * @return Index of selected sample
+    */
+unsigned int selectClockFilterSample (const NTPSample_t* samples, unsigned int numSamples, int64_t now);
+
+  /**
+    * @brief Calculates RMS of differences between offsets of all samples and selected one
+    * @param samples Samples, newest first
+    * @param numSamples Number of samples
+    * @param selected Index of selected sample
+    * @param correction Total correction applied by library on clock now, in microseconds
+    * @return Jitter in nanoseconds
+    */
+int64_t clockFilterJitter (const NTPSample_t* samples, unsigned int numSamples, unsigned int selected, int64_t correction);
+
+#endif // _ClockFilter_h
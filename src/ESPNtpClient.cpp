@@ -1,4 +1,8 @@
 #include "ESPNtpClient.h"
+#include <new>
+#ifdef ESP8266
+#include <Schedule.h>
+#endif
 
 
 #define DBG_PORT Serial
@@ -100,34 +104,156 @@ typedef struct __attribute__ ((packed, aligned (1))) {
 
 NTPClient NTP;
 
-const int seventyYears = 2208988800UL; // From 1900 to 1970
+char NTPClient::strBuffer[TIME_DATE_STR_LENGTH];
+
+  /**
+    * @brief Every request is a copy of this one with transmit timestamp set
+    */
+static const NTPUndecodedPacket_t requestTemplate = {
+    0b11100011,         // flags: LI unknown, version 4, client mode
+    0,                  // peerStratum
+    6,                  // pollingInterval
+    (int8_t)0xEC,       // clockPrecission: 1 us
+    {}, {}, {}, {}, {}, {}, {} // rootDelay, dispersion, refID, reference, origin, receive, transmit
+};
+
+  /**
+    * @brief Reads a big endian 32 bit word from a network buffer
+    * @param data Pointer to first byte. Does not need to be aligned
+    * @return Value in host order
+    */
+static inline uint32_t readUint32 (const uint8_t* data) {
+    uint32_t value;
+    memcpy (&value, data, sizeof (uint32_t));
+    return __builtin_bswap32 (value);
+}
+
+  /**
+    * @brief Reads a big endian NTP timestamp from a network buffer
+    * @param data Pointer to first byte. Does not need to be aligned
+    * @return Timestamp in host order
+    */
+static inline NTPTimestamp_t readTimestamp (const uint8_t* data) {
+    return ((NTPTimestamp_t)readUint32 (data) << 32) | readUint32 (data + sizeof (uint32_t));
+}
+
+  /**
+    * @brief Converts a signed 32.32 fixed point time difference to nanoseconds
+    * @param value Time difference in seconds, as signed 32.32 fixed point
+    * @return Time difference in nanoseconds
+    */
+static inline int64_t fixedPoint2ns (int64_t value) {
+    int64_t seconds = value >> 32; // Floor, so fraction is always positive
+    uint32_t fraction = (uint32_t)value;
+    return seconds * 1000000000LL + (int64_t)(((uint64_t)fraction * 1000000000ULL) >> 32);
+}
 
-int32_t flipInt32 (int32_t number) {
-    uint8_t output[sizeof (int32_t)];
-    uint8_t* input = (uint8_t*)&number;
-    //DEBUGLOGV ("Input number %08X", number);
+  /**
+    * @brief Converts a NTP timestamp to nanoseconds since 1-Jan-1970. NTP era is taken so that result is
+    * between 1970 and 2106, as `ntpTimestamp2timeval` does
+    * @param timestamp NTP timestamp
+    * @return UNIX time in nanoseconds
+    */
+static inline int64_t ntpTimestamp2unixNs (NTPTimestamp_t timestamp) {
+    uint32_t seconds = (uint32_t)(timestamp >> 32) - SEVENTY_YEARS;
+    return (int64_t)seconds * 1000000000LL + (int64_t)(((timestamp & 0xFFFFFFFFULL) * 1000000000ULL) >> 32);
+}
 
-    for (unsigned int i = 1; i <= sizeof (int32_t); i++) {
-        output[i - 1] = input[sizeof (int32_t) - i];
+  /**
+    * @brief Writes a zero padded decimal number without going through printf
+    * @param buffer Destination. Must have room for `digits` characters
+    * @param value Number to write
+    * @param digits Number of digits. Higher order digits are dropped
+    * @return Pointer to next character after written number
+    */
+static inline char* writeNumber (char* buffer, uint32_t value, unsigned int digits) {
+    for (unsigned int i = digits; i > 0; i--) {
+        buffer[i - 1] = '0' + value % 10;
+        value /= 10;
     }
+    return buffer + digits;
+}
+
+  /**
+    * @brief Writes `HH:MM:SS` from a broken down time
+    * @param buffer Destination. Must have room for 8 characters
+    * @param local_tm Broken down time
+    * @return Pointer to next character after written time
+    */
+static char* writeTime (char* buffer, const tm* local_tm) {
+    buffer = writeNumber (buffer, local_tm->tm_hour, 2);
+    *buffer++ = ':';
+    buffer = writeNumber (buffer, local_tm->tm_min, 2);
+    *buffer++ = ':';
+    return writeNumber (buffer, local_tm->tm_sec, 2);
+}
 
-    //DEBUGLOGV ("Output number %08X", *(int32_t*)output);
-    int32_t* result = (int32_t*)output;
-    return *result;
+  /**
+    * @brief Writes `dd/mm/yyyy` from a broken down time
+    * @param buffer Destination. Must have room for 10 characters
+    * @param local_tm Broken down time
+    * @return Pointer to next character after written date
+    */
+static char* writeDate (char* buffer, const tm* local_tm) {
+    buffer = writeNumber (buffer, local_tm->tm_mday, 2);
+    *buffer++ = '/';
+    buffer = writeNumber (buffer, local_tm->tm_mon + 1, 2);
+    *buffer++ = '/';
+    return writeNumber (buffer, local_tm->tm_year + 1900, 4);
 }
 
-int16_t flipInt16 (int16_t number) {
-    uint8_t output[sizeof (int16_t)];
-    uint8_t* input = (uint8_t*)&number;
-    //DEBUGLOGV ("Input number %08X", number);
+  /**
+    * @brief Writes `.uuuuuu` microseconds suffix
+    * @param buffer Destination. Must have room for 7 characters
+    * @param us Microseconds
+    * @return Pointer to next character after written suffix
+    */
+static inline char* writeMicros (char* buffer, long us) {
+    *buffer++ = '.';
+    return writeNumber (buffer, (uint32_t)us, 6);
+}
 
-    for (unsigned int i = 1; i <= sizeof (int16_t); i++) {
-        output[i - 1] = input[sizeof (int16_t) - i];
+  /**
+    * @brief Copies a string built on a temporary buffer to a caller buffer, truncating it if needed
+    * @param buffer Destination buffer
+    * @param size Destination buffer size
+    * @param source Zero terminated source string
+    * @return `buffer`
+    */
+static char* copyTruncated (char* buffer, size_t size, const char* source) {
+    if (size) {
+        strncpy (buffer, source, size - 1);
+        buffer[size - 1] = '\0';
     }
+    return buffer;
+}
 
-    //DEBUGLOGV ("Output number %08X", *(int32_t*)output);
-    int16_t* result = (int16_t*)output;
-    return *result;
+  /**
+    * @brief Builds a time and date string with microseconds and time zone abbreviation
+    * @param output Destination. Must have room for `TIME_DATE_STR_LENGTH` characters
+    * @param local_tm Local time breakdown
+    * @param us Microseconds
+    * @param format Format as `strftime`. If `NULL`, `dd/mm/yyyy HH:MM:SS` is built without `strftime`
+    * @param zoneName Time zone abbreviation. If `NULL`, system time zone one is used
+    * @return `output`
+    */
+static char* formatTimeDate (char* output, const tm* local_tm, long us, const char* format, const char* zoneName) {
+    char* end;
+
+    if (!format) {
+        end = writeDate (output, local_tm);
+        *end++ = ' ';
+        end = writeTime (end, local_tm);
+    } else {
+        end = output + strftime (output, TIME_DATE_STR_LENGTH - 8, format, local_tm);
+    }
+    end = writeMicros (end, us);
+    if (zoneName) {
+        snprintf (end, TIME_DATE_STR_LENGTH - (end - output), " %s", zoneName);
+    } else if (!strftime (end, TIME_DATE_STR_LENGTH - (end - output), " %Z", local_tm)) {
+        *end = '\0';
+    }
+    return output;
 }
 
 char* dumpNTPPacket (char* data, size_t length, char* buffer, int len) {
@@ -215,6 +341,9 @@ bool NTPClient::begin (const char* ntpServerName, bool manageWifi) {
     }
     lastSyncd.tv_sec = 0;
     lastSyncd.tv_usec = 0;
+    lockClock ();
+    publishTimeBase ();
+    unlockClock ();
 
     actualInterval = ntpTimeout + 500;
     
@@ -256,7 +385,12 @@ bool NTPClient::begin (const char* ntpServerName, bool manageWifi) {
     }
 #else
     loopTimer.attach_ms (ESP8266_LOOP_TASK_INTERVAL, &NTPClient::s_getTimeloop, (void*)this);
-    receiverTimer.attach_ms (ESP8266_RECEIVER_TASK_INTERVAL, &NTPClient::s_receiverTask, (void*)this);
+    if (!receiverScheduled) {
+        // Runs on every loop iteration. Responses are pushed to response queue on network callback and processed here
+        receiverScheduled = schedule_recurrent_function_us ([this] () {
+            return pollReceiver ();
+        }, 0);
+    }
 #endif
     
     // DEBUGLOGI ("First time sync request");
@@ -266,116 +400,167 @@ bool NTPClient::begin (const char* ntpServerName, bool manageWifi) {
 
 }
 
-void NTPClient::processPacket (struct pbuf* packet) {
+void NTPClient::processPacket (NTPResponse_t* response) {
     NTPPacket_t ntpPacket;
-    bool offsetApplied = false;
-    static bool wasPartial;
+    pbuf* packet = response->packet;
+    int64_t processStart = monotonicMicros ();
+    NTPTimestamp_t sendTime;
     
     if (!packet) {
         DEBUGLOGE ("Received packet empty");
+        return;
     }
     DEBUGLOGD ("Data lenght %d", packet->len);
+    NTP_TRACE_POINT (traceProcessStart, packet->len, 0);
 
-    if (!ntpRequested) {
-        DEBUGLOGE ("Unrequested response");
-        //pbuf_free (packet);
-        return;
-    }
-    
-    ntpRequested = false;
-    
-    if (packet->len < NTP_PACKET_SIZE) {
+    countMetric (metricResponses);
+    if (packet->len < NTP_PACKET_SIZE || !decodeNtpMessage ((uint8_t*)packet->payload, packet->len, &ntpPacket)) {
+        NTP_TRACE_POINT (traceDecoded, 0, 0);
         DEBUGLOGE ("Response Error");
-        status = unsyncd;
-        DEBUGLOGW ("Status set to UNSYNCD");
-        if (onSyncEvent) {
+        countMetric (metricRejectedMalformed);
+        if (eventsEnabled ()) {
             NTPEvent_t event;
             event.event = responseError;
             event.info.serverAddress = ntpServerIPAddress;
             event.info.port = DEFAULT_NTP_PORT;
             event.info.offset = 0;
             event.info.delay = 0;
-            onSyncEvent (event);
+            notifyEvent (event);
         }  
-        //pbuf_free (packet);
         return;
     }
 
-    responseTimer.detach ();
+    NTP_TRACE_POINT (traceDecoded, 1, 0);
 
-    if (!decodeNtpMessage ((uint8_t*)packet->payload, packet->len, &ntpPacket)) {
-        DEBUGLOGE ("Null pointer packet");
+    int serverIndex = matchRequest (ntpPacket.origin, &(response->address), response->port, &sendTime);
+    NTP_TRACE_POINT (traceMatched, serverIndex, 0);
+    if (serverIndex < 0) {
+        return;
+    }
+    ntpPacket.origin = sendTime; // Real departure time instead of matching key
+
+    if (!ntpRequested) {
+        DEBUGLOGE ("Unrequested response");
+        countMetric (metricRejectedLate);
         return;
     }
-    timeval tvOffset = calculateOffset (&ntpPacket);
     
-    int64_t offset_us = (int64_t)tvOffset.tv_sec * 1000000L + (int64_t)tvOffset.tv_usec;
-    offsetSum += offset_us;
+    ntpPacket.destination = timeval2ntpTimestamp (response->destination);
+    int64_t offset_ns = calculateOffset (&ntpPacket);
+    NTP_TRACE_POINT (traceOffset, offset_ns / 1000, delay / 1000);
+    // Every matched response is sampled, so that histograms also show responses rejected later
+    addHistogramSample (histogramRtt, delay > 0 ? (uint64_t)delay / 1000 : 0);
+    addHistogramSample (histogramOffset, (offset_ns < 0 ? 0 - (uint64_t)offset_ns : (uint64_t)offset_ns) / 1000);
+    latency.dispatch = processStart - response->received;
+    latency.process = monotonicMicros () - processStart;
+    DEBUGLOGD ("Dispatch %d us. Process %d us", latency.dispatch, latency.process);
+
+    if (numServers > 1) {
+        processServerSetResponse (&ntpPacket, serverIndex, offset_ns);
+        return;
+    }
+
+    if (burstEnabled) {
+        addClockFilterSample (offset_ns, delay, &ntpPacket);
+        lastBurstPacket = ntpPacket;
+        burstReceived++;
+        DEBUGLOGI ("Burst response %u of %u. Offset %lld ns", burstReceived, burstExpected, offset_ns);
+        if (burstReceived >= burstExpected) {
+            finishBurst ();
+        }
+        return;
+    }
+
+    ntpRequested = false;
+    responseTimer.detach ();
+
+    addClockFilterSample (offset_ns, delay, &ntpPacket);
     round++;
-    offsetAve = offsetSum / round;
-    DEBUGLOGI ("offset %lld -- sum %lld -- round %u -- average %lld", offset_us, offsetSum, round, offsetAve);
+    DEBUGLOGI ("offset %lld -- round %u", offset_ns, round);
     
     if (round >= numAveRounds) {
-        tvOffset.tv_sec = offsetAve / 1000000L;
-        tvOffset.tv_usec = offsetAve - tvOffset.tv_sec * 1000000;
-        //Serial.printf ("\nResult offset = %ld.%06ld\n\n", tvOffset.tv_sec, tvOffset.tv_usec);
         round = 0;
-        offsetSum = 0;
+        if (!getFilteredOffset (&filteredOffset)) {
+            skipClockUpdate ();
+            return;
+        }
+        DEBUGLOGI ("Filtered offset %lld ns. Jitter %lld ns", filteredOffset, jitter);
     } else {
         actualInterval = ntpTimeout + 500; // Set retry period equal to timeout + 500 ms
         DEBUGLOGI ("Retry in %u ms", actualInterval);
         return;
     }
     
-    if (abs (offsetAve) < timeSyncThreshold) {
+    processOffset (&ntpPacket);
+}
+
+void NTPClient::processOffset (NTPPacket_t* ntpPacket) {
+    bool offsetApplied = false;
+    static bool wasPartial;
+
+    int64_t filteredOffsetUs = filteredOffset / 1000;
+    if (abs (filteredOffsetUs) < timeSyncThreshold) {
         DEBUGLOGW ("Offset under threshold. Not updating");
+        updateFrequency (filteredOffsetUs, false);
+        updatePollInterval (filteredOffsetUs);
         status = syncd;
         numDispersionErrors = 0;
-        actualInterval = longInterval;
+        actualInterval = getSyncdInterval ();
         numSyncRetry = 0;
-        DEBUGLOGI ("Offset %0.3f ms is under threshold %ld. Not updating", offsetAve / 1000.0, timeSyncThreshold);
+        DEBUGLOGI ("Offset %0.3f ms is under threshold %ld. Not updating", filteredOffset / 1000000.0, timeSyncThreshold);
         if (wasPartial) {
             wasPartial = false;
-            if (onSyncEvent) {
+            if (eventsEnabled ()) {
                 NTPEvent_t event;
                 event.event = timeSyncd;
                 DEBUGLOGI ("Status set to SYNCD");
-                event.info.offset = offsetAve / 1000000.0;
+                event.info.offset = filteredOffset / 1000000000.0;
                 event.info.serverAddress = ntpServerIPAddress;
                 event.info.port = DEFAULT_NTP_PORT;
-                event.info.delay = delay;
-                event.info.dispersion = ntpPacket.dispersion;
-                onSyncEvent (event);
+                event.info.delay = delay / 1000000000.0;
+                event.info.dispersion = ntpPacket->dispersion ();
+                event.info.jitter = jitter / 1000000000.0;
+                event.info.slewRemaining = getSlewRemainingUs () / 1000000.0;
+                event.info.slewing = event.info.slewRemaining != 0;
+                event.info.frequency = getFrequencyPpm ();
+                event.info.frequencyWander = getFrequencyWanderPpm ();
+                notifyEvent (event);
             }
 
         } else {
-            if (onSyncEvent) {
+            if (eventsEnabled ()) {
                 NTPEvent_t event;
                 event.event = syncNotNeeded;
-                event.info.offset = offsetAve / 1000000.0;
-                event.info.dispersion = ntpPacket.dispersion;
+                event.info.offset = filteredOffset / 1000000000.0;
+                event.info.dispersion = ntpPacket->dispersion ();
+                event.info.jitter = jitter / 1000000000.0;
+                event.info.slewRemaining = getSlewRemainingUs () / 1000000.0;
+                event.info.slewing = event.info.slewRemaining != 0;
+                event.info.frequency = getFrequencyPpm ();
+                event.info.frequencyWander = getFrequencyWanderPpm ();
                 event.info.serverAddress = ntpServerIPAddress;
                 event.info.port = DEFAULT_NTP_PORT;
-                onSyncEvent (event);
+                notifyEvent (event);
             }
         }
         return;
     }
         
-    if (!checkNTPresponse (&ntpPacket, offsetAve)) {
+    if (!checkNTPresponse (ntpPacket, filteredOffsetUs)) {
         numDispersionErrors++;
         DEBUGLOGW ("Not valid or inaccurate response #%d", numDispersionErrors);
         if (numDispersionErrors > maxDispersionErrors) {
             numDispersionErrors = 0;
             
-            if (onSyncEvent) {
+            if (eventsEnabled ()) {
                 NTPEvent_t event;
                 event.event = accuracyError;
-                event.info.offset = offsetAve / 1000000.0;
-                event.info.dispersion = ntpPacket.dispersion;
+                event.info.offset = filteredOffset / 1000000000.0;
+                event.info.dispersion = ntpPacket->dispersion ();
+                event.info.jitter = jitter / 1000000000.0;
                 event.info.serverAddress = ntpServerIPAddress;
                 event.info.port = DEFAULT_NTP_PORT;
-                onSyncEvent (event);
+                notifyEvent (event);
             }
                             
             // if (status == syncd) {
@@ -391,20 +576,24 @@ void NTPClient::processPacket (struct pbuf* packet) {
         DEBUGLOGI ("Valid NTP response");
     }
 
-    if (!adjustOffset (&tvOffset)) {
+    updateFrequency (filteredOffsetUs, true);
+
+    if (!adjustOffset (filteredOffset)) {
         DEBUGLOGE ("Error applying offset");
-        if (onSyncEvent) {
+        if (eventsEnabled ()) {
             NTPEvent_t event;
             event.event = syncError;
             event.info.serverAddress = ntpServerIPAddress;
             event.info.port = DEFAULT_NTP_PORT;
-            event.info.offset = (float)tvOffset.tv_sec + (float)tvOffset.tv_usec / 1000000.0;
-            onSyncEvent (event);
+            event.info.offset = filteredOffset / 1000000000.0;
+            notifyEvent (event);
         }
     }
     offsetApplied = true;
+    int64_t slewRemaining = getSlewRemainingUs ();
 
-    if (tvOffset.tv_sec != 0 || abs (tvOffset.tv_usec) > minSyncAccuracyUs) { // Offset bigger than 10 ms
+    // A slewed offset is applied gradually, so there is no need to check it with a quick resync
+    if (abs (filteredOffsetUs) > minSyncAccuracyUs && !slewRemaining) { // Offset bigger than 10 ms
         DEBUGLOGW ("Minimum accuracy not reached. Repeating sync");
         if (numSyncRetry < maxNumSyncRetry) {
             DEBUGLOGI ("Status set to PARTIAL SYNC");
@@ -424,21 +613,26 @@ void NTPClient::processPacket (struct pbuf* packet) {
         if (wasPartial) {
             offsetApplied = true;
         }
-        //Serial.printf ("Status: %d wasPartial: %d offsetApplied %d Offset %0.3f\n", status, wasPartial, offsetApplied, ((float)tvOffset.tv_sec + (float)tvOffset.tv_usec / 1000000.0) * 1000);
         wasPartial = false;
     }
     if (status == partialSync) {
         actualInterval = ntpTimeout + 500; //shortInterval;
     } else {
-        actualInterval = longInterval;
+        updatePollInterval (filteredOffsetUs);
+        actualInterval = getSyncdInterval ();
         DEBUGLOGI ("Sync frequency set low");
     }
     DEBUGLOGI ("Interval set to = %d", actualInterval);
-    DEBUGLOGI ("Successful NTP sync at %s", getTimeDateString (getLastNTPSync ()));
+#if DEBUG_NTPCLIENT > 2
+    char timeStr[TIME_DATE_STR_LENGTH];
+#endif
+    DEBUGLOGI ("Successful NTP sync at %s", getTimeDateString (timeStr, sizeof (timeStr), getLastNTPSync ()));
+    countMetric (metricSyncs);
+    NTP_TRACE_POINT (traceSyncDone, status, 0);
     if (!firstSync.tv_sec) {
         firstSync = lastSyncd;
     }
-    if (offsetApplied && onSyncEvent) {
+    if (offsetApplied && eventsEnabled ()) {
         NTPEvent_t event;
         if (status == partialSync) {
             event.event = partlySync;
@@ -447,24 +641,50 @@ void NTPClient::processPacket (struct pbuf* packet) {
         } else {
             event.event = timeSyncd;
         }
-        event.info.offset = (float)tvOffset.tv_sec + (float)tvOffset.tv_usec / 1000000.0;
-        event.info.delay = delay;
-        event.info.dispersion = ntpPacket.dispersion;
+        event.info.offset = filteredOffset / 1000000000.0;
+        event.info.delay = delay / 1000000000.0;
+        event.info.dispersion = ntpPacket->dispersion ();
+        event.info.jitter = jitter / 1000000000.0;
         event.info.serverAddress = ntpServerIPAddress;
         event.info.port = DEFAULT_NTP_PORT;
-        onSyncEvent (event);
+        event.info.slewing = slewRemaining != 0;
+        event.info.slewRemaining = slewRemaining / 1000000.0;
+        event.info.frequency = getFrequencyPpm ();
+        event.info.frequencyWander = getFrequencyWanderPpm ();
+        notifyEvent (event);
     }
 }
 
 void NTPClient::s_recvPacket (void* arg, struct udp_pcb* pcb, struct pbuf* p,
                               const ip_addr_t* addr, u16_t port) {
-    NTPPacket_t ntpPacket;
+    timeval destination;
+    int64_t received = monotonicMicros (); // Arrival time is taken before anything else
     
+    (void)pcb; // Only one socket is used
     NTPClient* self = reinterpret_cast<NTPClient*>(arg);
-    gettimeofday (&(self->packetLastReceived), NULL);
+    self->getCorrectedTime (&destination);
+    NTP_TRACE_POINT (traceReceive, p->tot_len, port);
     DEBUGLOGI ("NTP Packet received from %s:%d", ipaddr_ntoa (addr), port);
-    self->lastNtpResponsePacket = p;
-    self->responsePacketValid = true;
+    
+    uint32_t head = self->responseQueueHead.load (std::memory_order_relaxed);
+    if (head - self->responseQueueTail.load (std::memory_order_acquire) >= RESPONSE_QUEUE_SIZE) {
+        self->responseQueueOverflows++;
+        DEBUGLOGW ("Response queue full. Packet dropped. %u overflows", self->responseQueueOverflows);
+        pbuf_free (p);
+        return;
+    }
+    NTPResponse_t* response = &(self->responseQueue[head & (RESPONSE_QUEUE_SIZE - 1)]);
+    response->packet = p;
+    response->destination = destination;
+    response->received = received;
+    response->address = *addr;
+    response->port = port;
+    self->responseQueueHead.store (head + 1, std::memory_order_release);
+#ifdef ESP32
+    if (self->receiverHandle) {
+        xTaskNotifyGive (self->receiverHandle);
+    }
+#endif // ESP32. On ESP8266 response queue is polled from loop by pollReceiver()
 }
 
 void NTPClient::s_receiverTask (void* arg) {
@@ -472,30 +692,156 @@ void NTPClient::s_receiverTask (void* arg) {
 #ifdef ESP32
     for (;;) {
     //while (!self->terminateTasks) {
+        ulTaskNotifyTake (pdTRUE, portMAX_DELAY); // Sleep until a response arrives
 #endif
-        if (self->responsePacketValid) {
-            self->processPacket (self->lastNtpResponsePacket);
-            if (self->lastNtpResponsePacket->ref > 0) {
+        uint32_t tail = self->responseQueueTail.load (std::memory_order_relaxed);
+        while (tail != self->responseQueueHead.load (std::memory_order_acquire)) {
+            NTPResponse_t* response = &(self->responseQueue[tail & (RESPONSE_QUEUE_SIZE - 1)]);
+            self->processPacket (response);
+            if (response->packet->ref > 0) {
 #ifdef ESP32
-                DEBUGLOGV ("pbuff type: %d", self->lastNtpResponsePacket->type_internal);
-                DEBUGLOGV ("pbuff ref: %d", self->lastNtpResponsePacket->ref);
-                DEBUGLOGV ("pbuff next: %p", self->lastNtpResponsePacket->next);
-                if (self->lastNtpResponsePacket->type_internal <= PBUF_POOL)
+                DEBUGLOGV ("pbuff type: %d", response->packet->type_internal);
+                DEBUGLOGV ("pbuff ref: %d", response->packet->ref);
+                DEBUGLOGV ("pbuff next: %p", response->packet->next);
+                if (response->packet->type_internal <= PBUF_POOL)
 #endif
-                    pbuf_free (self->lastNtpResponsePacket);
+                    pbuf_free (response->packet);
+            }
+            tail++;
+            self->responseQueueTail.store (tail, std::memory_order_release);
+        }
+        if (self->syncTimedOut) {
+            if (self->numServers > 1) {
+                self->finishServerSet ();
+            } else {
+                self->finishBurst ();
             }
-            self->responsePacketValid = false;
         }
 #ifdef ESP32
-        const TickType_t xDelay = 100 / portTICK_PERIOD_MS;
-        vTaskDelay (xDelay);
     }
     // DEBUGLOGW ("About to terminate receiver task. Handle %p", self->receiverHandle);
     //vTaskDelete (self->receiverHandle);
 #endif
 }
 
-char* NTPClient::getUptimeString () {
+tm* NTPClient::localTime (time_t moment, tm* result) {
+    uint32_t generation = tzGeneration.load (std::memory_order_acquire);
+    uint32_t sequence;
+    NTPLocalTimeCache_t cache;
+
+    do {
+        sequence = localTimeSequence.load (std::memory_order_acquire);
+        cache = localTimeCache;
+        std::atomic_thread_fence (std::memory_order_acquire);
+    } while ((sequence & 1) || sequence != localTimeSequence.load (std::memory_order_relaxed));
+
+    // Time zone transitions happen at minute boundaries, so breakdown inside a minute only differs in seconds
+    if (sequence && cache.generation == generation && moment >= cache.start && moment - cache.start < SECS_PER_MIN) {
+        *result = cache.minute;
+        result->tm_sec = moment - cache.start;
+        return result;
+    }
+
+    localtime_r (&moment, result);
+    if (result->tm_sec >= SECS_PER_MIN) { // Do not cache a leap second
+        return result;
+    }
+    cache.start = moment - result->tm_sec;
+    cache.minute = *result;
+    cache.minute.tm_sec = 0;
+    cache.generation = generation;
+
+#ifdef ESP32
+    portENTER_CRITICAL (&localTimeMux);
+#else
+    noInterrupts ();
+#endif
+    sequence = localTimeSequence.load (std::memory_order_relaxed);
+    localTimeSequence.store (sequence + 1, std::memory_order_relaxed); // Odd, readers retry
+    std::atomic_thread_fence (std::memory_order_release);
+    localTimeCache = cache;
+    localTimeSequence.store (sequence + 2, std::memory_order_release);
+#ifdef ESP32
+    portEXIT_CRITICAL (&localTimeMux);
+#else
+    interrupts ();
+#endif
+    return result;
+}
+
+char* NTPClient::getTimeStr (char* buffer, size_t size, timeval moment) {
+    tm local_tm;
+    char temp[TIME_STR_LENGTH];
+    char* output = size >= TIME_STR_LENGTH ? buffer : temp;
+
+    localTime (moment.tv_sec, &local_tm);
+    char* end = writeTime (output, &local_tm);
+    end = writeMicros (end, moment.tv_usec);
+    *end = '\0';
+    return output == buffer ? buffer : copyTruncated (buffer, size, temp);
+}
+
+char* NTPClient::getTimeStr (char* buffer, size_t size, time_t moment) {
+    tm local_tm;
+    char temp[TIME_STR_LENGTH];
+    char* output = size >= TIME_STR_LENGTH ? buffer : temp;
+
+    localTime (moment, &local_tm);
+    *writeTime (output, &local_tm) = '\0';
+    return output == buffer ? buffer : copyTruncated (buffer, size, temp);
+}
+
+char* NTPClient::getDateStr (char* buffer, size_t size, time_t moment) {
+    tm local_tm;
+    char temp[DATE_STR_LENGTH];
+    char* output = size >= DATE_STR_LENGTH ? buffer : temp;
+
+    localTime (moment, &local_tm);
+    *writeDate (output, &local_tm) = '\0';
+    return output == buffer ? buffer : copyTruncated (buffer, size, temp);
+}
+
+char* NTPClient::getTimeDateString (char* buffer, size_t size, timeval moment, const char* format) {
+    tm local_tm;
+    char temp[TIME_DATE_STR_LENGTH];
+    char* output = size >= TIME_DATE_STR_LENGTH ? buffer : temp;
+
+    localTime (moment.tv_sec, &local_tm);
+    formatTimeDate (output, &local_tm, moment.tv_usec, format, NULL);
+    return output == buffer ? buffer : copyTruncated (buffer, size, temp);
+}
+
+char* NTPClient::getTimeDateString (int zone, char* buffer, size_t size, timeval moment, const char* format) {
+    tm local_tm;
+    char temp[TIME_DATE_STR_LENGTH];
+    char* output = size >= TIME_DATE_STR_LENGTH ? buffer : temp;
+
+    if (!localTime (zone, moment.tv_sec, &local_tm)) {
+        return copyTruncated (buffer, size, "");
+    }
+    formatTimeDate (output, &local_tm, moment.tv_usec, format, timeZones[zone]->getAbbreviation (moment.tv_sec));
+    return output == buffer ? buffer : copyTruncated (buffer, size, temp);
+}
+
+char* NTPClient::getTimeDateString (char* buffer, size_t size, time_t moment, const char* format) {
+    tm local_tm;
+
+    localTime (moment, &local_tm);
+    if (!format) {
+        char temp[TIME_DATE_STR_LENGTH];
+        char* output = size >= TIME_DATE_STR_LENGTH ? buffer : temp;
+        char* end = writeDate (output, &local_tm);
+        *end++ = ' ';
+        *writeTime (end, &local_tm) = '\0';
+        return output == buffer ? buffer : copyTruncated (buffer, size, temp);
+    }
+    if (size && !strftime (buffer, size, format, &local_tm)) {
+        buffer[0] = '\0';
+    }
+    return buffer;
+}
+
+char* NTPClient::getUptimeString (char* buffer, size_t size) {
     uint16_t days;
     uint8_t hours;
     uint8_t minutes;
@@ -511,10 +857,23 @@ char* NTPClient::getUptimeString () {
     uptime -= hours * SECS_PER_HOUR;
     days = uptime / SECS_PER_DAY;
 
-    snprintf (strBuffer, sizeof (strBuffer) - 1, "%4u days %02d:%02d:%02d", days, hours, minutes, seconds);
+    snprintf (buffer, size, "%4u days %02d:%02d:%02d", days, hours, minutes, seconds);
 
-    return strBuffer;
+    return buffer;
+}
+
+#ifdef ESP8266
+bool NTPClient::pollReceiver () {
+    if (timeoutPending.exchange (false)) {
+        processRequestTimeout ();
+    }
+    if (responseQueueTail.load (std::memory_order_relaxed) != responseQueueHead.load (std::memory_order_acquire)
+        || syncTimedOut) {
+        s_receiverTask (this);
+    }
+    return true;
 }
+#endif // ESP8266
 
 void NTPClient::s_getTimeloop (void* arg) {
     NTPClient* self = reinterpret_cast<NTPClient*>(arg);
@@ -524,6 +883,8 @@ void NTPClient::s_getTimeloop (void* arg) {
 #endif // ESP32
         //DEBUGLOGI ("Running periodic task");
         static time_t lastGotTime;
+        self->syncSystemClock ();
+        self->accountStateTime ();
         if (::millis () - lastGotTime >= self->actualInterval) {
             lastGotTime = ::millis ();
             DEBUGLOGI ("Periodic loop. Millis = %d", lastGotTime);
@@ -599,19 +960,25 @@ void NTPClient::s_getTimeloop (void* arg) {
 
 void NTPClient::getTime () {
     err_t result;
-    static unsigned int dnsErrors = 0;
+    int64_t pollStart = monotonicMicros ();
+    NTP_TRACE_POINT (tracePollStart, numServers, burstEnabled ? burstSize : 1);
     
-    result = WiFi.hostByName (getNtpServerName (), ntpServerIPAddress);
-    if (!result) {
+    if (!resolveServer (0)) {
+        if (!servers[0].dnsFailed) {
+            DEBUGLOGI ("Waiting for %s to be resolved", ntpServerName);
+            actualInterval = ntpTimeout + 500;
+            return;
+        }
+        servers[0].dnsFailed = false;
         DEBUGLOGE ("HostByName error");
         dnsErrors++;
-        if (onSyncEvent) {
+        if (eventsEnabled ()) {
             NTPEvent_t event;
             event.event = invalidAddress;
             event.info.serverAddress = ntpServerIPAddress;
             event.info.port = DEFAULT_NTP_PORT;
 
-            onSyncEvent (event);
+            notifyEvent (event);
         }
         if (dnsErrors >= 3) {
             dnsErrors = 0;
@@ -622,6 +989,7 @@ void NTPClient::getTime () {
         }
         return;
     } else {
+        ntpServerIPAddress = servers[0].address;
         DEBUGLOGI ("NTP server address %s resolved to %s", ntpServerName, ntpServerIPAddress.toString ().c_str ());
     }
     dnsErrors = 0;
@@ -629,12 +997,36 @@ void NTPClient::getTime () {
         DEBUGLOGE ("IP address unset. Aborting");
         actualInterval = ntpTimeout + 500;
         DEBUGLOGI ("Set interval to = %d", actualInterval);
-        if (onSyncEvent) {
+        if (eventsEnabled ()) {
             NTPEvent_t event;
             event.event = invalidAddress;
             event.info.serverAddress = ntpServerIPAddress;
             event.info.port = DEFAULT_NTP_PORT;
-            onSyncEvent (event);
+            notifyEvent (event);
+        }
+        return;
+    }
+    
+    if (numServers > 1) {
+        if (!queryServerSet ()) {
+            DEBUGLOGE ("NTP request error");
+            if (eventsEnabled ()) {
+                NTPEvent_t event;
+                event.event = errorSending;
+                event.info.serverAddress = ntpServerIPAddress;
+                event.info.port = DEFAULT_NTP_PORT;
+                notifyEvent (event);
+            }
+            return;
+        }
+        latency.request = monotonicMicros () - pollStart;
+        DEBUGLOGI ("Requests sent %lld us after poll start", latency.request);
+        if (eventsEnabled ()) {
+            NTPEvent_t event;
+            event.event = requestSent;
+            event.info.serverAddress = ntpServerIPAddress;
+            event.info.port = DEFAULT_NTP_PORT;
+            notifyEvent (event);
         }
         return;
     }
@@ -650,150 +1042,702 @@ void NTPClient::getTime () {
     result = udp_connect (udp, &ntpAddr, DEFAULT_NTP_PORT);
     if (result == ERR_USE) {
         DEBUGLOGE ("Port already used");
-        if (onSyncEvent) {
+        if (eventsEnabled ()) {
             NTPEvent_t event;
             event.event = invalidPort;
             event.info.serverAddress = ntpServerIPAddress;
             event.info.port = DEFAULT_NTP_PORT;
-            onSyncEvent (event);
+            notifyEvent (event);
         }
     }
     if (result == ERR_RTE) {
         DEBUGLOGE ("Port already used");
-        if (onSyncEvent) {
+        if (eventsEnabled ()) {
             NTPEvent_t event;
             event.event = invalidAddress;
             event.info.serverAddress = ntpServerIPAddress;
             event.info.port = DEFAULT_NTP_PORT;
-            onSyncEvent (event);
+            notifyEvent (event);
         }
     }
     
     DEBUGLOGI ("Sending UDP packet");
     NTPStatus_t prevStatus = status;
     ntpRequested = true;
+    timeoutPending = false; // A timeout of previous request that was not processed yet does not apply to this one
     DEBUGLOGI ("Status set to REQUESTED");
-    responseTimer.once_ms (ntpTimeout, &NTPClient::s_processRequestTimeout, static_cast<void*>(this));
     
-    if (!sendNTPpacket ()) {
+    bool sent;
+    if (burstEnabled) {
+        burstTimer.detach ();
+        burstSent = 0;
+        burstReceived = 0;
+        burstExpected = burstSize;
+        syncTimedOut = false;
+        // Timeout counts from last request
+        responseTimer.once_ms (ntpTimeout + burstSpacing * (burstSize - 1), &NTPClient::s_processRequestTimeout, static_cast<void*>(this));
+        sent = sendNTPpacket ();
+        if (sent) {
+            burstSent = 1;
+            if (burstSize > 1) {
+                burstTimer.attach_ms (burstSpacing, &NTPClient::s_sendBurstPacket, static_cast<void*>(this));
+            }
+        }
+    } else {
+        responseTimer.once_ms (ntpTimeout, &NTPClient::s_processRequestTimeout, static_cast<void*>(this));
+        sent = sendNTPpacket ();
+    }
+    
+    if (!sent) {
         responseTimer.detach ();
+        ntpRequested = false;
         DEBUGLOGE ("NTP request error");
         status = prevStatus;
         DEBUGLOGE ("Status recovered due to UDP send error");
-        if (onSyncEvent) {
+        if (eventsEnabled ()) {
             NTPEvent_t event;
             event.event = errorSending;
             event.info.serverAddress = ntpServerIPAddress;
             event.info.port = DEFAULT_NTP_PORT;
-            onSyncEvent (event);
+            notifyEvent (event);
         }
         return;
     }
-    if (onSyncEvent) {
+    latency.request = monotonicMicros () - pollStart;
+    DEBUGLOGI ("Request sent %lld us after poll start", latency.request);
+    if (eventsEnabled ()) {
         NTPEvent_t event;
         event.event = requestSent;
         event.info.serverAddress = ntpServerIPAddress;
         event.info.port = DEFAULT_NTP_PORT;
-        onSyncEvent (event);
+        notifyEvent (event);
     }
     //udp_disconnect (udp);
     
 }
 
-boolean NTPClient::sendNTPpacket () {
-    err_t result;
-    timeval currentime;
-    pbuf* buffer;
-    NTPUndecodedPacket_t packet;
-    buffer = pbuf_alloc (PBUF_TRANSPORT, sizeof (NTPUndecodedPacket_t), PBUF_RAM);
-    if (!buffer) {
-        DEBUGLOGE ("Cannot allocate UDP packet buffer");
-        return false;
+void NTPClient::s_sendBurstPacket (void* arg) {
+    NTPClient* self = reinterpret_cast<NTPClient*>(arg);
+    self->sendBurstPacket ();
+}
+
+void NTPClient::sendBurstPacket () {
+    if (!ntpRequested || burstSent >= burstExpected) {
+        burstTimer.detach ();
+        return;
     }
-    buffer->len = sizeof (NTPUndecodedPacket_t);
-    buffer->tot_len = sizeof (NTPUndecodedPacket_t);
+    if (sendNTPpacket ()) {
+        burstSent++;
+    } else {
+        DEBUGLOGW ("Burst request %u not sent", burstSent);
+        burstExpected = burstSent; // Finish burst with requests sent until now
+    }
+    if (burstSent >= burstExpected) {
+        burstTimer.detach ();
+    }
+}
 
-    memset (&packet, 0, sizeof (NTPUndecodedPacket_t));
-    
-    packet.flags = 0b11100011;
-    packet.peerStratum = 0;
-    packet.pollingInterval = 6;
-    packet.clockPrecission = 0xEC; // 1 us
+void NTPClient::finishBurst () {
+    responseTimer.detach ();
+    burstTimer.detach ();
+    syncTimedOut = false;
+    if (!ntpRequested) {
+        return;
+    }
+    ntpRequested = false;
+    DEBUGLOGI ("Burst finished with %u responses", burstReceived);
+    round = burstReceived;
+    bool newSample = getFilteredOffset (&filteredOffset);
+    round = 0;
+    if (!newSample) {
+        skipClockUpdate ();
+        return;
+    }
+    DEBUGLOGI ("Filtered offset %lld ns. Jitter %lld ns", filteredOffset, jitter);
+    processOffset (&lastBurstPacket);
+}
 
-    gettimeofday (&currentime, NULL);
-    
-    DEBUGLOGI ("sendNTPpacket");
-    
-    if (currentime.tv_sec != 0) {
-        packet.transmit.secondsOffset = flipInt32 (currentime.tv_sec + seventyYears);
-        DEBUGLOGV ("Current time: %ld.%ld", currentime.tv_sec, currentime.tv_usec);
-        uint32_t timestamp_us = (uint32_t)((double)(currentime.tv_usec) / 1000000.0 * (double)0x100000000);
-        DEBUGLOGV ("timestamp_us = 0x%08X %lu", timestamp_us, timestamp_us);
-        packet.transmit.fraction = flipInt32 (timestamp_us);
-        DEBUGLOGV ("Transmit: 0x%08X : 0x%08X", packet.transmit.secondsOffset, packet.transmit.fraction);
-        
-    } else {
-        packet.transmit.secondsOffset = 0;
-        packet.transmit.fraction = 0;
+bool NTPClient::setBurstMode (bool enable, int size, int spacing) {
+    if (size < 1 || size > MAX_BURST_SIZE || spacing < 0) {
+        return false;
     }
+    burstTimer.detach ();
+    burstEnabled = enable;
+    burstSize = size;
+    burstSpacing = spacing;
+    return true;
+}
 
-#if DEBUG_NTPCLIENT > 4
-    const int sizeStr = 200;
-    char strPacketBuffer[sizeStr];
-    DEBUGLOGV ("NTP Packet\n%s", dumpNTPPacket ((char*)&packet, sizeof (NTPUndecodedPacket_t), strPacketBuffer, sizeStr));
-#endif
+bool NTPClient::resolveServer (unsigned int index) {
+    NTPServer_t* server = &(servers[index]);
 
-    DEBUGLOGI ("Sending packet");
-    memcpy (buffer->payload, &packet, sizeof (NTPUndecodedPacket_t));
-    result = udp_send (udp, buffer);
-    if (buffer->ref > 0) {
+    collectDnsResult (index);
+    if (server->addressValid && monotonicMicros () < server->addressExpiry) {
+        return true;
+    }
+    if (server->dnsState.load (std::memory_order_acquire) == dnsIdle) {
+        strncpy (server->queryName, getServerName (index), SERVER_NAME_LENGTH);
+        server->resolveStart = ::millis ();
+        countMetric (metricDnsQueries);
+        NTP_TRACE_POINT (traceDnsStart, index, 0);
+        server->dnsState.store (dnsQueued, std::memory_order_release);
+        // lwIP API is not thread safe, so resolution is started on network stack task
 #ifdef ESP32
-        DEBUGLOGV ("pbuff type: %d", buffer->type_internal);
-        DEBUGLOGV ("pbuff ref: %d", buffer->ref);
-        DEBUGLOGV ("pbuff next: %p", buffer->next);
-        if (buffer->type_internal <= PBUF_POOL)
-#endif
-            pbuf_free (buffer);
+#if LWIP_TCPIP_CORE_LOCKING
+        LOCK_TCPIP_CORE ();
+        s_startDnsQueries (this);
+        UNLOCK_TCPIP_CORE ();
+#else
+        if (tcpip_callback (&NTPClient::s_startDnsQueries, this) != ERR_OK) {
+            uint8_t queued = dnsQueued;
+            server->dnsState.compare_exchange_strong (queued, dnsError, std::memory_order_release);
+        } else {
+            // Network stack task starts query at once. Waiting for it lets an address that lwIP has on
+            // cache, or a name that is an IP address, be used on this sync instead of the next one
+            uint32_t waitStart = ::millis ();
+            while (server->dnsState.load (std::memory_order_acquire) == dnsQueued && ::millis () - waitStart < DNS_START_WAIT) {
+                vTaskDelay (1);
+            }
+        }
+#endif // LWIP_TCPIP_CORE_LOCKING
+#else
+        s_startDnsQueries (this); // Network stack runs on the same context as sync loop
+#endif // ESP32
+        collectDnsResult (index); // Got from lwIP cache or name is an IP address
     }
-    if (result == ERR_OK) {
-        DEBUGLOGI ("UDP packet sent");
-        return true;
+    // Last known good address is used while resolution is pending or DNS is down
+    return server->addressValid;
+}
+
+void NTPClient::collectDnsResult (unsigned int index) {
+    NTPServer_t* server = &(servers[index]);
+    uint8_t state = server->dnsState.load (std::memory_order_acquire);
+
+    if (state != dnsResolved && state != dnsError) {
+        return;
+    }
+    if (!strncmp (server->queryName, getServerName (index), SERVER_NAME_LENGTH)) {
+        if (state == dnsResolved) {
+            server->address = server->resolvedAddress;
+            server->addressValid = true;
+            server->addressExpiry = monotonicMicros () + dnsCacheLifetime;
+            server->dnsFailed = false;
+            DEBUGLOGI ("%s resolved to %s", server->queryName, server->address.toString ().c_str ());
+        } else {
+            server->dnsFailed = true;
+            countMetric (metricDnsErrors);
+            DEBUGLOGW ("Cannot resolve %s", server->queryName);
+        }
     } else {
-        DEBUGLOGE ("Error sending UDP datagram. %d: %s", result, lwip_strerr (result));
-        return false;
+        DEBUGLOGI ("Server name changed while resolving %s", server->queryName);
     }
+    server->dnsState.store (dnsIdle, std::memory_order_relaxed);
 }
 
-void ICACHE_RAM_ATTR NTPClient::s_processRequestTimeout (void* arg) {
+void NTPClient::s_startDnsQueries (void* arg) {
     NTPClient* self = reinterpret_cast<NTPClient*>(arg);
-    self->processRequestTimeout ();
+    ip_addr_t address;
+
+    for (unsigned int i = 0; i < MAX_NTP_SERVERS; i++) {
+        NTPServer_t* server = &(self->servers[i]);
+        if (server->dnsState.load (std::memory_order_acquire) != dnsQueued) {
+            continue;
+        }
+        server->dnsState.store (dnsInProgress, std::memory_order_relaxed);
+        err_t result = dns_gethostbyname (server->queryName, &address, &NTPClient::s_dnsFound, self);
+        if (result == ERR_OK) {
+            self->finishDnsQuery (i, &address);
+        } else if (result != ERR_INPROGRESS) {
+            DEBUGLOGE ("Cannot resolve %s. %d: %s", server->queryName, result, lwip_strerr (result));
+            self->finishDnsQuery (i, NULL);
+        }
+    }
 }
 
-void ICACHE_RAM_ATTR NTPClient::processRequestTimeout () {
-    //NTPStatus_t prevStatus = status;
-    //DEBUGLOGW ("Status set to UNSYNCD");
-    numTimeouts++;
-    ntpRequested = false;
-    responseTimer.detach ();
-    DEBUGLOGE ("NTP response Timeout");
-    if (onSyncEvent) {
-        NTPEvent_t event;
-        event.event = noResponse;
-        event.info.serverAddress = ntpServerIPAddress;
-        event.info.port = DEFAULT_NTP_PORT;
-        onSyncEvent (event);
+void NTPClient::finishDnsQuery (unsigned int index, const ip_addr_t* address) {
+    NTPServer_t* server = &(servers[index]);
+
+    NTP_TRACE_POINT (traceDnsDone, index, address ? 1 : 0);
+    addHistogramSample (histogramDnsLatency, ::millis () - server->resolveStart);
+    // Socket is bound to an IPv4 address, so IPv6 results cannot be used
+    if (address && IP_IS_V4 (address)) {
+        server->resolvedAddress = ip4_addr_get_u32 (ip_2_ip4 (address));
+        server->dnsState.store (dnsResolved, std::memory_order_release);
+    } else {
+        server->dnsState.store (dnsError, std::memory_order_release);
     }
-    if (numTimeouts >= DEAULT_NUM_TIMEOUTS) {
-        numTimeouts = 0;
-        actualInterval = shortInterval;
-        DEBUGLOGE ("Waiting for %u ms", actualInterval);
+}
+
+void NTPClient::s_dnsFound (const char* name, const ip_addr_t* address, void* arg) {
+    NTPClient* self = reinterpret_cast<NTPClient*>(arg);
+
+    for (unsigned int i = 0; i < MAX_NTP_SERVERS; i++) {
+        NTPServer_t* server = &(self->servers[i]);
+        if (server->dnsState.load (std::memory_order_relaxed) != dnsInProgress
+            || strncmp (name, server->queryName, SERVER_NAME_LENGTH)) {
+            continue;
+        }
+        self->finishDnsQuery (i, address);
     }
-    // if (status==syncd) {
-    //     actualInterval = longInterval;
-    // } else {
-    //     actualInterval = shortInterval;
-    // }
-    //DEBUGLOGI ("Set interval to = %d", actualInterval);
+}
+
+bool NTPClient::queryServerSet () {
+    ip_addr_t address;
+
+    // Responses come from several addresses, so socket cannot be connected to one of them
+    udp_disconnect (udp);
+    responseTimer.detach ();
+    serverRequests = 0;
+    serverResponses = 0;
+    serverPending = 1; // Responses got while sending do not finish sync before all requests are sent
+    syncTimedOut = false;
+    timeoutPending = false;
+    ntpRequested = true;
+    responseTimer.once_ms (ntpTimeout, &NTPClient::s_processRequestTimeout, static_cast<void*>(this));
+
+    for (unsigned int i = 0; i < numServers; i++) {
+        NTPServer_t* server = &(servers[i]);
+        server->answered = false;
+        server->rejected = false;
+        if (i > 0 && !resolveServer (i)) { // Main server is already resolved
+            DEBUGLOGW ("No address for %s yet", serverNames[i - 1]);
+            continue;
+        }
+        if (server->address == IPAddress (INADDR_NONE)) {
+            continue;
+        }
+#ifdef ESP32
+        address.type = IPADDR_TYPE_V4;
+        address.u_addr.ip4.addr = server->address;
+#else
+        address.addr = server->address;
+#endif
+        serverPending++; // Counted before sending, as response may arrive before send returns
+        if (sendNTPpacket (&address, i)) {
+            DEBUGLOGI ("Request sent to server %u %s", i, ipaddr_ntoa (&address));
+            serverRequests++;
+        } else {
+            serverPending--;
+        }
+    }
+
+    if (!serverRequests) {
+        responseTimer.detach ();
+        ntpRequested = false;
+        return false;
+    }
+    if (serverPending.fetch_sub (1) == 1) {
+        // Every response arrived while requests were being sent
+        finishServerSet ();
+    }
+    return true;
+}
+
+void NTPClient::processServerSetResponse (NTPPacket_t* ntpPacket, unsigned int index, int64_t offsetNs) {
+    NTPServer_t* server = &(servers[index]);
+
+    if (server->answered || server->rejected) {
+        return;
+    }
+    // A not valid response is not used for selection, but it is counted so that sync does not wait for timeout.
+    // Accuracy is checked later on combined offset
+    if (!checkNTPpacket (ntpPacket)) {
+        DEBUGLOGW ("Server %u response not valid", index);
+        server->rejected = true;
+    } else {
+        server->offset = offsetNs;
+        server->delay = delay < 0 ? 0 : delay;
+        server->distance = server->delay / 2
+            + (int64_t)((ntpPacket->rootDelay () / 2 + ntpPacket->dispersion () + ntpPacket->clockPrecission ()) * 1000000000.0);
+        server->packet = *ntpPacket;
+        server->answered = true;
+        DEBUGLOGI ("Server %u offset %lld ns. Distance %lld ns", index, server->offset, server->distance);
+    }
+    serverResponses++;
+    if (serverPending.fetch_sub (1) == 1) {
+        finishServerSet ();
+    }
+}
+
+unsigned int NTPClient::selectServers (int64_t* combinedOffset, unsigned int* best) {
+    struct {
+        int64_t value;
+        int type;
+    } edges[2 * MAX_NTP_SERVERS];
+    unsigned int numEdges = 0;
+    unsigned int numAnswered = 0;
+
+    for (unsigned int i = 0; i < numServers; i++) {
+        if (servers[i].answered) {
+            edges[numEdges].value = servers[i].offset - servers[i].distance;
+            edges[numEdges++].type = -1;
+            edges[numEdges].value = servers[i].offset + servers[i].distance;
+            edges[numEdges++].type = 1;
+            numAnswered++;
+        }
+    }
+    // Sort edges. Lower edges go first on ties so touching intervals intersect
+    for (unsigned int i = 1; i < numEdges; i++) {
+        for (unsigned int j = i; j > 0 && (edges[j].value < edges[j - 1].value ||
+                                             (edges[j].value == edges[j - 1].value && edges[j].type < edges[j - 1].type)); j--) {
+            auto edge = edges[j];
+            edges[j] = edges[j - 1];
+            edges[j - 1] = edge;
+        }
+    }
+    // Marzullo: find interval contained in the largest number of correctness intervals
+    int count = 0;
+    int maxCount = 0;
+    int64_t low = 0;
+    int64_t high = 0;
+    for (unsigned int i = 0; i < numEdges; i++) {
+        count -= edges[i].type;
+        if (count > maxCount && i + 1 < numEdges) {
+            maxCount = count;
+            low = edges[i].value;
+            high = edges[i + 1].value;
+        }
+    }
+    DEBUGLOGI ("Intersection [%lld, %lld] ns agreed by %d of %u servers", low, high, maxCount, numAnswered);
+    if (maxCount * 2 <= (int)numAnswered) {
+        return 0; // No majority of truechimers
+    }
+
+    // Survivors are weighted by inverse of their root distance
+    double weightSum = 0;
+    double offsetSum = 0;
+    unsigned int survivors = 0;
+    for (unsigned int i = 0; i < numServers; i++) {
+        NTPServer_t* server = &(servers[i]);
+        if (!server->answered || server->offset - server->distance > high || server->offset + server->distance < low) {
+            DEBUGLOGD ("Server %u rejected", i);
+            continue;
+        }
+        double weight = 1.0 / (server->distance + 1);
+        weightSum += weight;
+        offsetSum += weight * server->offset;
+        if (!survivors || server->distance < servers[*best].distance) {
+            *best = i;
+        }
+        survivors++;
+    }
+    *combinedOffset = (int64_t)(offsetSum / weightSum);
+    return survivors;
+}
+
+void NTPClient::finishServerSet () {
+    int64_t combinedOffset;
+    unsigned int best = 0;
+
+    responseTimer.detach ();
+    syncTimedOut = false;
+    if (!ntpRequested) {
+        return;
+    }
+    ntpRequested = false;
+    DEBUGLOGI ("Server set sync finished with %u of %u responses", serverResponses.load (), serverRequests.load ());
+    
+    if (!selectServers (&combinedOffset, &best)) {
+        DEBUGLOGW ("Servers do not agree");
+        actualInterval = shortInterval;
+        if (eventsEnabled ()) {
+            NTPEvent_t event;
+            event.event = accuracyError;
+            event.info.serverAddress = ntpServerIPAddress;
+            event.info.port = DEFAULT_NTP_PORT;
+            notifyEvent (event);
+        }
+        return;
+    }
+    
+    addClockFilterSample (combinedOffset, servers[best].delay, &(servers[best].packet));
+    round = 1;
+    bool newSample = getFilteredOffset (&filteredOffset);
+    round = 0;
+    if (!newSample) {
+        skipClockUpdate ();
+        return;
+    }
+    DEBUGLOGI ("Combined offset %lld ns. Filtered offset %lld ns", combinedOffset, filteredOffset);
+    processOffset (&(servers[best].packet));
+}
+
+bool NTPClient::addNtpServer (const char* serverName) {
+    if (!serverName || !strnlen (serverName, SERVER_NAME_LENGTH) || numServers >= MAX_NTP_SERVERS) {
+        return false;
+    }
+    // Responses of a sync in progress and pending name resolutions refer to servers by index
+    uint8_t dnsState = servers[numServers].dnsState.load (std::memory_order_acquire);
+    if (ntpRequested || dnsState == dnsQueued || dnsState == dnsInProgress) {
+        DEBUGLOGW ("Cannot add server while a sync is in progress");
+        return false;
+    }
+    if (strnlen (serverName, SERVER_NAME_LENGTH) >= SERVER_NAME_LENGTH) {
+        return false;
+    }
+    strncpy (serverNames[numServers - 1], serverName, SERVER_NAME_LENGTH);
+    servers[numServers].addressValid = false;
+    servers[numServers].addressExpiry = 0;
+    servers[numServers].dnsState.store (dnsIdle, std::memory_order_relaxed); // Result of a removed server is discarded
+    servers[numServers].dnsFailed = false;
+    numServers++;
+    DEBUGLOGI ("Server %s added. %u servers", serverName, numServers);
+    return true;
+}
+
+bool NTPClient::setTimeZoneByName (const char* name) {
+    const char* tz = findTimeZone (name);
+    char buffer[TZNAME_LENGTH];
+
+    if (!tz) {
+        DEBUGLOGW ("Time zone %s not found", name ? name : "NULL");
+        return false;
+    }
+    strncpy_P (buffer, tz, TZNAME_LENGTH - 1); // Database is stored in flash
+    buffer[TZNAME_LENGTH - 1] = '\0';
+    DEBUGLOGI ("Time zone %s: %s", name, buffer);
+    setTimeZone (buffer);
+    return true;
+}
+
+int NTPClient::addTimeZone (const char* tz) {
+    uint8_t zone = numTimeZones.load (std::memory_order_relaxed);
+
+    if (zone >= MAX_TIME_ZONES) {
+        DEBUGLOGW ("Cannot add time zone %s. Too many zones", tz ? tz : "NULL");
+        return -1;
+    }
+    // Zones take memory only when they are used
+    if (!timeZones[zone]) {
+        timeZones[zone] = new (std::nothrow) TimeZone ();
+    }
+    if (!timeZones[zone] || !timeZones[zone]->setRules (tz)) {
+        DEBUGLOGW ("Cannot add time zone %s", tz ? tz : "NULL");
+        return -1;
+    }
+    numTimeZones.store (zone + 1, std::memory_order_release); // Publish only after zone is built
+    DEBUGLOGI ("Time zone %s added with id %u", tz, zone);
+    return zone;
+}
+
+NTPRequest_t* NTPClient::addRequest (IPAddress address, uint8_t server) {
+    int64_t now = monotonicMicros ();
+    NTPRequest_t* request = &(pendingRequests[0]);
+
+    for (unsigned int i = 0; i < MAX_PENDING_REQUESTS; i++) {
+        if (pendingRequests[i].state.load (std::memory_order_relaxed) == requestEntryFree || pendingRequests[i].expiry < now) {
+            request = &(pendingRequests[i]);
+            break;
+        }
+        if (pendingRequests[i].expiry < request->expiry) {
+            request = &(pendingRequests[i]);
+        }
+    }
+    request->state.store (requestEntryReserved);
+    request->address = address;
+    request->server = server;
+    request->expiry = now + ntpTimeout * 1000LL;
+    request->sendLatency.store (0, std::memory_order_relaxed);
+    return request;
+}
+
+int NTPClient::matchRequest (NTPTimestamp_t origin, const ip_addr_t* address, uint16_t port, NTPTimestamp_t* sendTime) {
+    IPAddress source;
+#ifdef ESP32
+    source = address->u_addr.ip4.addr;
+#else
+    source = address->addr;
+#endif
+
+    if (origin) {
+        for (unsigned int i = 0; i < MAX_PENDING_REQUESTS; i++) {
+            NTPRequest_t* request = &(pendingRequests[i]);
+            if (request->state.load (std::memory_order_acquire) != requestEntrySent || request->transmit != origin) {
+                continue;
+            }
+            if (request->address != source || port != DEFAULT_NTP_PORT) {
+                DEBUGLOGW ("Response from unexpected source %s:%u", source.toString ().c_str (), port);
+                countMetric (metricRejectedBadSource);
+                return -1;
+            }
+            // Request leaves when udp_send returns. Time spent in network stack is not network delay.
+            // If response is processed before that, latency is not known yet and it is taken as zero
+            NTPTimestamp_t departure = request->sendTime + (((uint64_t)request->sendLatency.load (std::memory_order_acquire) << 32) / 1000000);
+            int64_t expiry = request->expiry;
+            int serverIndex = request->server;
+            uint8_t sent = requestEntrySent;
+            if (!request->state.compare_exchange_strong (sent, requestEntryFree)) {
+                continue; // Duplicated responses are discarded
+            }
+            if (expiry < monotonicMicros ()) {
+                DEBUGLOGW ("Late response from %s", source.toString ().c_str ());
+                countMetric (metricRejectedLate);
+                return -1;
+            }
+            *sendTime = departure;
+            return serverIndex;
+        }
+    }
+    DEBUGLOGW ("Response from %s does not match any pending request", source.toString ().c_str ());
+    countMetric (metricRejectedUnknownOrigin);
+    return -1;
+}
+
+pbuf* NTPClient::getRequestBuffer () {
+    if (requestBuffer && requestBuffer->ref > 1) {
+        // Previous request is still queued by network stack, i.e. waiting for ARP. It will be freed when sent
+        DEBUGLOGW ("Request buffer still in use");
+        pbuf_free (requestBuffer);
+        requestBuffer = NULL;
+    }
+    if (!requestBuffer) {
+        requestBuffer = pbuf_alloc (PBUF_TRANSPORT, sizeof (NTPUndecodedPacket_t), PBUF_RAM);
+        if (!requestBuffer) {
+            return NULL;
+        }
+        requestPayload = requestBuffer->payload;
+        memcpy (requestPayload, &requestTemplate, sizeof (NTPUndecodedPacket_t));
+        DEBUGLOGI ("Request buffer allocated");
+    } else {
+        // Headers added by network stack on previous send are dropped. Request data is kept unchanged
+        requestBuffer->payload = requestPayload;
+        requestBuffer->len = sizeof (NTPUndecodedPacket_t);
+        requestBuffer->tot_len = sizeof (NTPUndecodedPacket_t);
+    }
+    return requestBuffer;
+}
+
+boolean NTPClient::sendNTPpacket (const ip_addr_t* destination, uint8_t server) {
+    err_t result;
+    timeval currentime;
+    pbuf* buffer;
+    NTPUndecodedPacket_t* packet;
+    int64_t prepareStart = monotonicMicros ();
+
+    DEBUGLOGI ("sendNTPpacket");
+    buffer = getRequestBuffer ();
+    if (!buffer) {
+        DEBUGLOGE ("Cannot allocate UDP packet buffer");
+        return false;
+    }
+    packet = (NTPUndecodedPacket_t*)requestPayload;
+
+    IPAddress address = ntpServerIPAddress;
+    if (destination) {
+#ifdef ESP32
+        address = destination->u_addr.ip4.addr;
+#else
+        address = destination->addr;
+#endif
+    }
+    // Request is registered before it is sent, so that a quick response finds it
+    NTPRequest_t* request = addRequest (address, server);
+
+    int64_t sendStart = monotonicMicros ();
+    getCorrectedTime (&currentime);
+    
+    // Transmit timestamp is always set, even before first sync, because response is matched with it
+    NTPTimestamp_t sendTimestamp = timeval2ntpTimestamp (currentime);
+    NTPTimestamp_t transmitTimestamp = sendTimestamp;
+    if (randomizeTransmit) {
+        // Bits under clock resolution carry no time information. Random data makes forging a response harder
+        const uint32_t randomMask = (1UL << TRANSMIT_RANDOM_BITS) - 1;
+#ifdef ESP32
+        transmitTimestamp = (transmitTimestamp & ~(NTPTimestamp_t)randomMask) | (esp_random () & randomMask);
+#else
+        transmitTimestamp = (transmitTimestamp & ~(NTPTimestamp_t)randomMask) | (RANDOM_REG32 & randomMask);
+#endif // ESP32
+    }
+    packet->transmit.secondsOffset = __builtin_bswap32 ((uint32_t)(transmitTimestamp >> 32));
+    packet->transmit.fraction = __builtin_bswap32 ((uint32_t)transmitTimestamp);
+    request->sendTime = sendTimestamp;
+    request->transmit = transmitTimestamp;
+    request->state.store (requestEntrySent, std::memory_order_release); // Entry is complete before a response may match it
+
+    NTP_TRACE_POINT (traceSendStart, server, 0);
+    if (destination) {
+        result = udp_sendto (udp, buffer, destination, DEFAULT_NTP_PORT);
+    } else {
+        result = udp_send (udp, buffer);
+    }
+    int64_t sendEnd = monotonicMicros ();
+    NTP_TRACE_POINT (traceSendDone, server, result);
+    latency.prepare = sendStart - prepareStart;
+    latency.send = sendEnd - sendStart;
+    if (postSendTimestamp) {
+        request->sendLatency.store ((uint32_t)(sendEnd - sendStart), std::memory_order_release);
+    }
+
+    DEBUGLOGV ("Current time: %ld.%ld", currentime.tv_sec, currentime.tv_usec);
+    DEBUGLOGV ("Transmit: 0x%08X : 0x%08X", packet->transmit.secondsOffset, packet->transmit.fraction);
+#if DEBUG_NTPCLIENT > 4
+    const int sizeStr = 200;
+    char strPacketBuffer[sizeStr];
+    DEBUGLOGV ("NTP Packet\n%s", dumpNTPPacket ((char*)packet, sizeof (NTPUndecodedPacket_t), strPacketBuffer, sizeStr));
+#endif
+    DEBUGLOGD ("Prepare %d us. Send %d us", latency.prepare, latency.send);
+
+    if (result != ERR_OK) {
+        request->state.store (requestEntryFree);
+    }
+    if (result == ERR_OK) {
+        DEBUGLOGI ("UDP packet sent");
+        countMetric (metricRequestsSent);
+        return true;
+    } else {
+        DEBUGLOGE ("Error sending UDP datagram. %d: %s", result, lwip_strerr (result));
+        countMetric (metricSendErrors);
+        return false;
+    }
+}
+
+void ICACHE_RAM_ATTR NTPClient::s_processRequestTimeout (void* arg) {
+    NTPClient* self = reinterpret_cast<NTPClient*>(arg);
+#ifdef ESP32
+    self->processRequestTimeout ();
+#else
+    self->timeoutPending = true;
+#endif // ESP32
+}
+
+void NTPClient::processRequestTimeout () {
+    //NTPStatus_t prevStatus = status;
+    //DEBUGLOGW ("Status set to UNSYNCD");
+    burstTimer.detach ();
+    NTP_TRACE_POINT (traceTimeout, numServers > 1 ? serverResponses.load () : burstReceived, 0);
+    if ((numServers > 1 && serverResponses) || (numServers == 1 && burstEnabled && burstReceived)) {
+        // Sync is finished by receiver with responses got until now
+        syncTimedOut = true;
+#ifdef ESP32
+        if (receiverHandle) {
+            xTaskNotifyGive (receiverHandle);
+        }
+#endif // ESP32. On ESP8266 pollReceiver() runs receiver right after this
+        return;
+    }
+    numTimeouts++;
+    countMetric (metricTimeouts);
+    ntpRequested = false;
+    responseTimer.detach ();
+    DEBUGLOGE ("NTP response Timeout");
+    if (eventsEnabled ()) {
+        NTPEvent_t event;
+        event.event = noResponse;
+        event.info.serverAddress = ntpServerIPAddress;
+        event.info.port = DEFAULT_NTP_PORT;
+        notifyEvent (event);
+    }
+    if (numTimeouts >= DEAULT_NUM_TIMEOUTS) {
+        numTimeouts = 0;
+        actualInterval = shortInterval;
+        DEBUGLOGE ("Waiting for %u ms", actualInterval);
+    }
+    // if (status==syncd) {
+    //     actualInterval = longInterval;
+    // } else {
+    //     actualInterval = shortInterval;
+    // }
+    //DEBUGLOGI ("Set interval to = %d", actualInterval);
 }
 
 bool NTPClient::setNtpServerName (const char* serverName) {
@@ -806,6 +1750,8 @@ bool NTPClient::setNtpServerName (const char* serverName) {
     DEBUGLOGI ("NTP server set to %s", serverName);
     memset (ntpServerName, 0, SERVER_NAME_LENGTH);
     strncpy (ntpServerName, serverName, strnlen (serverName, SERVER_NAME_LENGTH));
+    servers[0].addressValid = false; // Cached address belongs to previous name. A pending resolution is discarded when it finishes
+    servers[0].addressExpiry = 0;
     return true;
 }
 
@@ -816,7 +1762,7 @@ bool NTPClient::setInterval (int interval) {
             longInterval = newInterval;
             DEBUGLOGI ("Sync interval set to %d s", interval);
             if (syncStatus () == syncd) {
-                actualInterval = longInterval;
+                actualInterval = getSyncdInterval ();
                 DEBUGLOGI ("Set interval to = %d", actualInterval);
             }
         }
@@ -824,7 +1770,7 @@ bool NTPClient::setInterval (int interval) {
     } else {
         longInterval = MIN_NTP_INTERVAL * 1000;
         if (syncStatus () == syncd) {
-            actualInterval = longInterval;
+            actualInterval = getSyncdInterval ();
             DEBUGLOGI ("Set interval to = %d", actualInterval);
         }
         DEBUGLOGW ("Too low value. Sync interval set to minimum: %d s", MIN_NTP_INTERVAL);
@@ -842,7 +1788,7 @@ bool NTPClient::setInterval (int shortInterval, int longInterval) {
             actualInterval = this->shortInterval;
 
         } else {
-            actualInterval = this->longInterval;
+            actualInterval = getSyncdInterval ();
         }
         DEBUGLOGI ("Interval set to = %d", actualInterval);
         DEBUGLOGI ("Short sync interval set to %d s", shortInterval);
@@ -855,6 +1801,80 @@ bool NTPClient::setInterval (int shortInterval, int longInterval) {
 }
 
 
+bool NTPClient::setAdaptiveInterval (bool enable, int minInterval, int maxInterval) {
+    if (enable) {
+        if (minInterval < MIN_NTP_INTERVAL || maxInterval < minInterval) {
+            DEBUGLOGW ("Invalid adaptive interval limits");
+            return false;
+        }
+        uint8_t minExponent = 0;
+        uint8_t maxExponent = 0;
+        // Minimum is rounded up so that interval is never shorter than MIN_NTP_INTERVAL
+        while ((1L << minExponent) < minInterval && minExponent < MAX_POLL_EXPONENT) {
+            minExponent++;
+        }
+        while ((2L << maxExponent) <= maxInterval && maxExponent < MAX_POLL_EXPONENT) {
+            maxExponent++;
+        }
+        if (maxExponent < minExponent) {
+            maxExponent = minExponent;
+        }
+        minPollExponent = minExponent;
+        maxPollExponent = maxExponent;
+        // Start from configured interval
+        pollExponent = minPollExponent;
+        while (pollExponent < maxPollExponent && (2UL << pollExponent) * 1000UL <= longInterval) {
+            pollExponent++;
+        }
+        pollHysteresis = 0;
+        DEBUGLOGI ("Adaptive interval from %lu to %lu s", 1UL << minPollExponent, 1UL << maxPollExponent);
+    }
+    adaptivePoll = enable;
+    if (syncStatus () == syncd) {
+        actualInterval = getSyncdInterval ();
+        DEBUGLOGI ("Set interval to = %d", actualInterval);
+    }
+    return true;
+}
+
+void NTPClient::updatePollInterval (int64_t offsetUs) {
+    if (!adaptivePoll) {
+        return;
+    }
+
+    // Clock error that current frequency change would cause along current interval
+    int64_t frequencyErrorUs = (int64_t)(1UL << pollExponent) * (frequencyChange < 0 ? -frequencyChange : frequencyChange) / 1000;
+    frequencyChange = 0;
+
+    // Jitter is added to offset as measurement error
+    int64_t errorUs = abs (offsetUs) + jitter / 1000;
+
+    if (errorUs > minSyncAccuracyUs || frequencyErrorUs > minSyncAccuracyUs) {
+        // Out of bounds. Interval is reduced at once
+        pollHysteresis = 0;
+        if (pollExponent > minPollExponent) {
+            pollExponent--;
+        }
+    } else if (errorUs < minSyncAccuracyUs / 2 && frequencyErrorUs < minSyncAccuracyUs / 2) {
+        pollHysteresis += pollExponent;
+        if (pollHysteresis > POLL_HYSTERESIS_LIMIT) {
+            pollHysteresis = 0;
+            if (pollExponent < maxPollExponent) {
+                pollExponent++;
+            }
+        }
+    } else {
+        pollHysteresis -= 2 * pollExponent;
+        if (pollHysteresis < -POLL_HYSTERESIS_LIMIT) {
+            pollHysteresis = 0;
+            if (pollExponent > minPollExponent) {
+                pollExponent--;
+            }
+        }
+    }
+    DEBUGLOGI ("Adaptive interval %lu s. Hysteresis %d", 1UL << pollExponent, pollHysteresis);
+}
+
 bool NTPClient::setNTPTimeout (uint16_t milliseconds) {
 
     if (milliseconds >= MIN_NTP_TIMEOUT) {
@@ -868,176 +1888,139 @@ bool NTPClient::setNTPTimeout (uint16_t milliseconds) {
 }
 
 void NTPClient::dumpNtpPacketInfo (NTPPacket_t* decPacket) {
+    char timeStr[TIME_DATE_STR_LENGTH];
+
     Serial.print ("------ Decoded NTP message -------\n");
     Serial.printf ("LI = %u\n", decPacket->flags.li);
     Serial.printf ("Version = %u\n", decPacket->flags.vers);
     Serial.printf ("Mode = %u\n", decPacket->flags.mode);
     Serial.printf ("Peer Stratum = %u\n", decPacket->peerStratum);
-    Serial.printf ("Polling Interval = %u s\n", decPacket->pollingInterval);
-    Serial.printf ("Clock Precission = %0.3f us\n", decPacket->clockPrecission * 1000000.0);
-    Serial.printf ("Root delay: %0.3f ms\n", decPacket->rootDelay * 1000.0);
-    Serial.printf ("Dispersion: %0.3f ms\n", decPacket->dispersion * 1000.0);
+    Serial.printf ("Polling Interval = %u s\n", decPacket->pollingInterval ());
+    Serial.printf ("Clock Precission = %0.3f us\n", decPacket->clockPrecission () * 1000000.0);
+    Serial.printf ("Root delay: %0.3f ms\n", decPacket->rootDelay () * 1000.0);
+    Serial.printf ("Dispersion: %0.3f ms\n", decPacket->dispersion () * 1000.0);
     if (decPacket->peerStratum > 1) {
         Serial.printf ("refID: %u.%u.%u.%u\n", decPacket->refID[0], decPacket->refID[1], decPacket->refID[2], decPacket->refID[3]);
     } else {
         Serial.printf ("refID: %.*s\n", 4, (char*)(decPacket->refID));
     }
-    Serial.printf ("Reference: %s\n", getTimeDateString (decPacket->reference));
-    Serial.printf ("Origin: %s\n", getTimeDateString (decPacket->origin));
-    Serial.printf ("Receive: %s\n", getTimeDateString (decPacket->receive));
-    Serial.printf ("Transmit: %s\n", getTimeDateString (decPacket->transmit));
+    Serial.printf ("Reference: %s\n", getTimeDateString (timeStr, sizeof (timeStr), ntpTimestamp2timeval (decPacket->reference)));
+    Serial.printf ("Origin: %s\n", getTimeDateString (timeStr, sizeof (timeStr), ntpTimestamp2timeval (decPacket->origin)));
+    Serial.printf ("Receive: %s\n", getTimeDateString (timeStr, sizeof (timeStr), ntpTimestamp2timeval (decPacket->receive)));
+    Serial.printf ("Transmit: %s\n", getTimeDateString (timeStr, sizeof (timeStr), ntpTimestamp2timeval (decPacket->transmit)));
 }
 
 NTPPacket_t* NTPClient::decodeNtpMessage (uint8_t* messageBuffer, size_t length, NTPPacket_t* decPacket) {
-    NTPUndecodedPacket_t recPacket;
-    int32_t timestamp_s;
-    uint32_t timestamp_us;
-
     if (length < NTP_PACKET_SIZE) {
         return NULL;
     }
 
-    memcpy (&recPacket, messageBuffer, NTP_PACKET_SIZE);
-
     DEBUGLOGI ("Decoded NTP message");
 #ifdef DEBUG_NTPCLIENT
     char buffer[250];
 #endif
     DEBUGLOGV ("\n%s", dumpNTPPacket ((char*)messageBuffer, length, buffer, 250));
 
-    decPacket->flags.li = recPacket.flags >> 6;
+    // Fields are read in place from the received buffer. Timestamps are kept in NTP fixed point format
+    uint8_t flags = messageBuffer[offsetof (NTPUndecodedPacket_t, flags)];
+    decPacket->flags.li = flags >> 6;
     DEBUGLOGD ("LI = %u", decPacket->flags.li);
 
-    decPacket->flags.vers = recPacket.flags >> 3 & 0b111;
+    decPacket->flags.vers = flags >> 3 & 0b111;
     DEBUGLOGD ("Version = %u", decPacket->flags.vers);
 
-    decPacket->flags.mode = recPacket.flags & 0b111;
+    decPacket->flags.mode = flags & 0b111;
     DEBUGLOGD ("Mode = %u", decPacket->flags.mode);
 
-    decPacket->peerStratum = recPacket.peerStratum;
+    decPacket->peerStratum = messageBuffer[offsetof (NTPUndecodedPacket_t, peerStratum)];
     DEBUGLOGD ("Peer Stratum = %u", decPacket->peerStratum);
 
-    decPacket->pollingInterval = pow (2, recPacket.pollingInterval);
-    DEBUGLOGD ("Polling Interval = %u", decPacket->pollingInterval);
+    decPacket->pollingExponent = (int8_t)messageBuffer[offsetof (NTPUndecodedPacket_t, pollingInterval)];
+    DEBUGLOGD ("Polling Interval = %u", decPacket->pollingInterval ());
 
-    decPacket->clockPrecission = pow (2, recPacket.clockPrecission);
-    DEBUGLOGD ("Clock Precission = %0.3f us", decPacket->clockPrecission * 1000000);
+    decPacket->precisionExponent = (int8_t)messageBuffer[offsetof (NTPUndecodedPacket_t, clockPrecission)];
+    DEBUGLOGD ("Clock Precission = %0.3f us", decPacket->clockPrecission () * 1000000);
 
-    int16_t ts16_s = flipInt16 (recPacket.rootDelay.secondsOffset);
-    uint16_t ts16_us = flipInt16 (recPacket.rootDelay.fraction);
-    decPacket->rootDelay = (float)ts16_s + (float)ts16_us / (float)0x10000;
-    DEBUGLOGD ("Root delay: 0x%08X", recPacket.rootDelay);
-    DEBUGLOGD ("Root delay: %0.3f ms", decPacket->rootDelay * 1000);
+    decPacket->rootDelayRaw = readUint32 (messageBuffer + offsetof (NTPUndecodedPacket_t, rootDelay));
+    DEBUGLOGD ("Root delay: 0x%08X", decPacket->rootDelayRaw);
+    DEBUGLOGD ("Root delay: %0.3f ms", decPacket->rootDelay () * 1000);
 
-    ts16_s = flipInt16 (recPacket.dispersion.secondsOffset);
-    ts16_us = flipInt16 (recPacket.dispersion.fraction);
-    decPacket->dispersion = (float)ts16_s + (float)ts16_us / (float)0x10000;
-    DEBUGLOGD ("Dispersion: 0x%08X", recPacket.dispersion);
-    DEBUGLOGD ("Dispersion: %0.3f ms", decPacket->dispersion * 1000);
+    decPacket->dispersionRaw = readUint32 (messageBuffer + offsetof (NTPUndecodedPacket_t, dispersion));
+    DEBUGLOGD ("Dispersion: 0x%08X", decPacket->dispersionRaw);
+    DEBUGLOGD ("Dispersion: %0.3f ms", decPacket->dispersion () * 1000);
 
-    memcpy (&(decPacket->refID), &(recPacket.refID), 4);
+    memcpy (&(decPacket->refID), messageBuffer + offsetof (NTPUndecodedPacket_t, refID), 4);
     if (decPacket->peerStratum > 1) {
         DEBUGLOGD ("refID: %u.%u.%u.%u", decPacket->refID[0], decPacket->refID[1], decPacket->refID[2], decPacket->refID[3]);
     } else {
         DEBUGLOGD ("refID: %.*s", 4, (char*)(decPacket->refID));
     }
 
-    // Reference timestamp
-    timestamp_s = flipInt32 (recPacket.reference.secondsOffset);
-    timestamp_us = flipInt32 (recPacket.reference.fraction);
-    //DEBUGLOGV ("timestamp_us %08X = %lu", timestamp_us, timestamp_us);
-    if (timestamp_s) {
-        decPacket->reference.tv_sec = timestamp_s - seventyYears;
-    } else {
-        decPacket->reference.tv_sec = 0;
-    }
-    decPacket->reference.tv_usec = ((float)(timestamp_us) / (float)0x100000000 * 1000000.0);
-    //DEBUGLOGV ("Reference: seconds %08X fraction %08X", recPacket.reference.secondsOffset, recPacket.reference.fraction);
-    //DEBUGLOGV ("Reference: %d.%06ld", decPacket->reference.tv_sec, decPacket->reference.tv_usec);
-    DEBUGLOGV ("Reference: %s.%06ld", ctime (&(decPacket->reference.tv_sec)), decPacket->reference.tv_usec);
-
-    // Origin timestamp
-    timestamp_s = flipInt32 (recPacket.origin.secondsOffset);
-    timestamp_us = flipInt32 (recPacket.origin.fraction);
-    //DEBUGLOGV ("timestamp_us %08X = %lu", timestamp_us, timestamp_us);
-    if (timestamp_s) {
-        decPacket->origin.tv_sec = timestamp_s - seventyYears;
-    } else {
-        decPacket->origin.tv_sec = 0;
-    }
-    decPacket->origin.tv_usec = ((float)(timestamp_us) / (float)0x100000000 * 1000000.0);
-    //DEBUGLOGV ("Origin: seconds %08X fraction %08X", recPacket.origin.secondsOffset, recPacket.origin.fraction);
-    //DEBUGLOGV ("Origin: %d.%06ld", decPacket->origin.tv_sec, decPacket->origin.tv_usec);
-    DEBUGLOGV ("Origin: %s.%06ld", ctime (&(decPacket->origin.tv_sec)), decPacket->origin.tv_usec);
-
-    // Receive timestamp
-    timestamp_s = flipInt32 (recPacket.receive.secondsOffset);
-    timestamp_us = flipInt32 (recPacket.receive.fraction);
-    //DEBUGLOGV ("timestamp_us %08X = %lu", timestamp_us, timestamp_us);
-    if (timestamp_s) {
-        decPacket->receive.tv_sec = timestamp_s - seventyYears;
-    } else {
-        decPacket->receive.tv_sec = 0;
-    }
-    decPacket->receive.tv_usec = ((float)(timestamp_us) / (float)0x100000000 * 1000000.0);
-    //DEBUGLOGV ("Receive: seconds %08X fraction %08X", recPacket.receive.secondsOffset, recPacket.receive.fraction);
-    //DEBUGLOGV ("Receive: %d.%06ld", decPacket->receive.tv_sec, decPacket->receive.tv_usec);
-    DEBUGLOGV ("Receive: %s.%06ld", ctime (&(decPacket->receive.tv_sec)), decPacket->receive.tv_usec);
+    decPacket->reference = readTimestamp (messageBuffer + offsetof (NTPUndecodedPacket_t, reference));
+    DEBUGLOGV ("Reference: %08X.%08X", (uint32_t)(decPacket->reference >> 32), (uint32_t)decPacket->reference);
 
-    // Transmit timestamp
-    timestamp_s = flipInt32 (recPacket.transmit.secondsOffset);
-    timestamp_us = flipInt32 (recPacket.transmit.fraction);
-    //DEBUGLOGV ("timestamp_us %08X = %lu", timestamp_us, timestamp_us);
+    decPacket->origin = readTimestamp (messageBuffer + offsetof (NTPUndecodedPacket_t, origin));
+    DEBUGLOGV ("Origin: %08X.%08X", (uint32_t)(decPacket->origin >> 32), (uint32_t)decPacket->origin);
 
-    if (timestamp_s) {
-        decPacket->transmit.tv_sec = timestamp_s - seventyYears;
-    } else {
-        decPacket->transmit.tv_sec = 0;
-    }
-    decPacket->transmit.tv_usec = ((float)(timestamp_us) / (float)0x100000000 * 1000000.0);
-    //DEBUGLOGV ("Transmit: seconds %08X fraction %08X", recPacket.transmit.secondsOffset, recPacket.transmit.fraction);
-    //DEBUGLOGV ("Transmit: %d.%06ld", decPacket->transmit.tv_sec, decPacket->transmit.tv_usec);
-    DEBUGLOGV ("Transmit: %s.%06ld", ctime (&(decPacket->transmit.tv_sec)), decPacket->transmit.tv_usec);
-    
-    decPacket->destination = packetLastReceived;
+    decPacket->receive = readTimestamp (messageBuffer + offsetof (NTPUndecodedPacket_t, receive));
+    DEBUGLOGV ("Receive: %08X.%08X", (uint32_t)(decPacket->receive >> 32), (uint32_t)decPacket->receive);
+
+    decPacket->transmit = readTimestamp (messageBuffer + offsetof (NTPUndecodedPacket_t, transmit));
+    DEBUGLOGV ("Transmit: %08X.%08X", (uint32_t)(decPacket->transmit >> 32), (uint32_t)decPacket->transmit);
 
     return decPacket;
 }
 
-bool NTPClient::checkNTPresponse (NTPPacket_t* ntpPacket, int64_t offsetUs) {
+bool NTPClient::checkNTPpacket (NTPPacket_t* ntpPacket) {
     //dumpNtpPacketInfo (ntpPacket);
     if (ntpPacket->flags.li != 0) {
         DEBUGLOGE ("Leap indicator error: %d", ntpPacket->flags.li);
+        countMetric (metricRejectedLeap);
         return false;
     }
     
     if (ntpPacket->flags.vers != 4) {
         DEBUGLOGE ("NTP version error: %d", ntpPacket->flags.vers);
+        countMetric (metricRejectedVersion);
         return false;
     }
 
     if (ntpPacket->flags.mode != 4) {
         DEBUGLOGE ("NTP mode error: %d", ntpPacket->flags.mode);
+        countMetric (metricRejectedMode);
         return false;
     }
     
     if (ntpPacket->peerStratum < 1 || ntpPacket->peerStratum > 15) {
         DEBUGLOGE ("Peer stratum error: %d", ntpPacket->peerStratum);
+        countMetric (metricRejectedStratum);
+        return false;
+    }
+
+    return true;
+}
+
+bool NTPClient::checkNTPresponse (NTPPacket_t* ntpPacket, int64_t offsetUs) {
+    if (!checkNTPpacket (ntpPacket)) {
         return false;
     }
 
     if (status == syncd || status == partialSync) {
-        //Serial.printf ("Peer precission:   %0.9f s\n", ntpPacket->clockPrecission);
+        //Serial.printf ("Peer precission:   %0.9f s\n", ntpPacket->clockPrecission ());
         //Serial.printf ("minSyncAccuracyUs: %0.9f s\n", minSyncAccuracyUs / 10000000.0);
-        if (ntpPacket->clockPrecission > (float)(minSyncAccuracyUs / 10000000.0)/* || ntpPacket->clockPrecission == 0.0*/) { // 5 zeroes, that's correct. us*1000000 / 10
-            DEBUGLOGE ("Peer precission error: %0.3f us > minSyncAccuracyUs/10 %0.3f", ntpPacket->clockPrecission * 1000000.0, minSyncAccuracyUs / 10.0);
+        if (ntpPacket->clockPrecission () > (float)(minSyncAccuracyUs / 10000000.0)/* || ntpPacket->clockPrecission () == 0.0*/) { // 5 zeroes, that's correct. us*1000000 / 10
+            DEBUGLOGE ("Peer precission error: %0.3f us > minSyncAccuracyUs/10 %0.3f", ntpPacket->clockPrecission () * 1000000.0, minSyncAccuracyUs / 10.0);
+            countMetric (metricRejectedPrecision);
             return false;
         }
 
-        //Serial.printf ("Dispersion:        %0.6f s\n", ntpPacket->dispersion);
+        //Serial.printf ("Dispersion:        %0.6f s\n", ntpPacket->dispersion ());
         //Serial.printf ("Offset:            %0.6f s\n", offsetUs / 1000000.0);
-        if (ntpPacket->dispersion > abs (offsetUs / 1000000.0) || ntpPacket->dispersion == 0.0) {
-            DEBUGLOGE ("Dispersion error: %0.3f ms > Offset: %0.3f ms", ntpPacket->dispersion * 1000.0, (float)(offsetUs / 1000.0));
+        // Dispersion is compared in NTP short format to avoid float operations
+        int64_t offsetShort = ((offsetUs < 0 ? -offsetUs : offsetUs) << 16) / 1000000L;
+        if ((int64_t)ntpPacket->dispersionRaw > offsetShort || ntpPacket->dispersionRaw == 0) {
+            DEBUGLOGE ("Dispersion error: %0.3f ms > Offset: %0.3f ms", ntpPacket->dispersion () * 1000.0, (float)(offsetUs / 1000.0));
+            countMetric (metricRejectedDispersion);
             return false;
         }
     }
@@ -1045,51 +2028,83 @@ bool NTPClient::checkNTPresponse (NTPPacket_t* ntpPacket, int64_t offsetUs) {
     return true;
 }
 
-timeval NTPClient::calculateOffset (NTPPacket_t* ntpPacket) {
-    double t1, t2, t3, t4;
-    timeval tv_offset;
+int64_t NTPClient::calculateOffset (NTPPacket_t* ntpPacket) {
+    NTPTimestamp_t t1 = ntpPacket->origin;
+    NTPTimestamp_t t2 = ntpPacket->receive;
+    NTPTimestamp_t t3 = ntpPacket->transmit;
+    NTPTimestamp_t t4 = ntpPacket->destination;
+
+    // A zero origin carries no departure time. Arrival time is used, so delay is only server processing time
+    if (!t1) {
+        t1 = t4;
+    }
 
-    t1 = ntpPacket->origin.tv_sec + ntpPacket->origin.tv_usec / 1000000.0;
-    t2 = ntpPacket->receive.tv_sec + ntpPacket->receive.tv_usec / 1000000.0;
-    t3 = ntpPacket->transmit.tv_sec + ntpPacket->transmit.tv_usec / 1000000.0;
-    t4 = ntpPacket->destination.tv_sec + ntpPacket->destination.tv_usec / 1000000.0;
-    offset = ((t2 - t1) / 2.0 + (t3 - t4) / 2.0); // in seconds
-    delay = (t4 - t1) - (t3 - t2); // in seconds
+    // Delay only uses differences between timestamps of the same clock, so it is always right
+    delay = fixedPoint2ns ((int64_t)(t4 - t1) - (int64_t)(t3 - t2));
 
-    DEBUGLOGV ("T1: %f T2: %f T3: %f T4: %f", t1, t2, t3, t4);
-    DEBUGLOGD ("T1: %s", getTimeDateString (ntpPacket->origin));
-    //DEBUGLOGV ("T1: %016X  %016X", ntpPacket->origin.tv_sec, ntpPacket->origin.tv_usec);
-    DEBUGLOGD ("T2: %s", getTimeDateString (ntpPacket->receive));
-    //DEBUGLOGV ("T2: %016X  %016X", ntpPacket->receive.tv_sec, ntpPacket->receive.tv_usec);
-    DEBUGLOGD ("T3: %s", getTimeDateString (ntpPacket->transmit));
-    //DEBUGLOGV ("T3: %016X  %016X", ntpPacket->transmit.tv_sec, ntpPacket->transmit.tv_usec);
-    DEBUGLOGD ("T4: %s", getTimeDateString (ntpPacket->destination));
-    //DEBUGLOGV ("T4: %016X  %016X", ntpPacket->destination.tv_sec, ntpPacket->destination.tv_usec);
-    DEBUGLOGI ("Offset: %f, Delay: %f", offset, delay);
+    if (!t4 || (uint32_t)((t4 >> 32) - SEVENTY_YEARS) < MIN_VALID_UNIX_TIME) {
+        // Local clock is not set, so it may be more than 68 years away from server time and differences between
+        // both clocks cannot be read as signed values. Offset is server transmit time in UNIX time minus local
+        // arrival time, plus half delay
+        offset = ntpTimestamp2unixNs (t3) - (t4 ? ntpTimestamp2unixNs (t4) : 0) + delay / 2;
+    } else {
+        // Differences are calculated modulo 2^64 and read as signed values so that they are right across
+        // NTP era boundaries as far as both timestamps are less than 68 years away.
+        // Each difference is halved before addition to avoid overflow
+        int64_t d21 = (int64_t)(t2 - t1);
+        int64_t d34 = (int64_t)(t3 - t4);
+        offset = fixedPoint2ns ((d21 >> 1) + (d34 >> 1));
+    }
 
-    tv_offset.tv_sec = (time_t)offset;
-    tv_offset.tv_usec = (offset - (double)tv_offset.tv_sec) * 1000000.0;
+#if DEBUG_NTPCLIENT > 3
+    char timeStr[TIME_DATE_STR_LENGTH];
+#endif
+    DEBUGLOGV ("T1: %08X.%08X T2: %08X.%08X T3: %08X.%08X T4: %08X.%08X",
+               (uint32_t)(t1 >> 32), (uint32_t)t1, (uint32_t)(t2 >> 32), (uint32_t)t2,
+               (uint32_t)(t3 >> 32), (uint32_t)t3, (uint32_t)(t4 >> 32), (uint32_t)t4);
+    DEBUGLOGD ("T1: %s", getTimeDateString (timeStr, sizeof (timeStr), ntpTimestamp2timeval (t1)));
+    DEBUGLOGD ("T2: %s", getTimeDateString (timeStr, sizeof (timeStr), ntpTimestamp2timeval (t2)));
+    DEBUGLOGD ("T3: %s", getTimeDateString (timeStr, sizeof (timeStr), ntpTimestamp2timeval (t3)));
+    DEBUGLOGD ("T4: %s", getTimeDateString (timeStr, sizeof (timeStr), ntpTimestamp2timeval (t4)));
 
-    DEBUGLOGI ("Calculated offset %f sec. Delay %f ms", offset, delay * 1000);
+    DEBUGLOGI ("Calculated offset %lld ns. Delay %lld ns", offset, delay);
 
-    return tv_offset;
+    return offset;
 }
 
-bool NTPClient::adjustOffset (timeval* offset) {
+bool NTPClient::adjustOffset (int64_t offsetNs) {
     timeval newtime;
     timeval currenttime;
+    int64_t offset_us = offsetNs / 1000;
+    int64_t now = monotonicMicros ();
+
+    // Part of previous slew that is already applied is kept. The rest is included in new offset
+    NTP_TRACE_POINT (traceAdjustStart, offset_us, 0);
+    lockClock ();
+    foldClockCorrection (now);
+    slewEnd = now;
+
+    if (slewEnabled && abs (offset_us) < slewPanicThreshold) {
+        slewRate = offset_us * 1000000000LL / slewWindow;
+        slewEnd = now + slewWindow;
+        publishTimeBase ();
+        unlockClock ();
+        getCorrectedTime (&lastSyncd);
+        NTP_TRACE_POINT (traceAdjustDone, 1, 1);
+        DEBUGLOGI ("Slewing %lld us in %lld s", offset_us, slewWindow / 1000000);
+        return true;
+    }
 
     gettimeofday (&currenttime, NULL);
 
     int64_t currenttime_us = (int64_t)currenttime.tv_sec * 1000000L + (int64_t)currenttime.tv_usec;
-    int64_t offset_us = (int64_t)offset->tv_sec * 1000000L + (int64_t)offset->tv_usec;
 
     // Serial.printf ("currenttime  %ld.%ld\n", currenttime.tv_sec, currenttime.tv_usec);
     // Serial.printf ("currenttime_us: %f\n", currenttime_us);
-    // Serial.printf ("offset  %ld.%ld\n", offset->tv_sec, offset->tv_usec);
     // Serial.printf ("offset_us: %f\n", offset_us);
 
-    int64_t newtime_us = currenttime_us + offset_us;
+    // Offset was measured against library time, so correction not moved to system clock yet is included
+    int64_t newtime_us = currenttime_us + clockCorrection + offset_us;
 
     newtime.tv_sec = newtime_us / 1000000L;
     newtime.tv_usec = newtime_us - ((int64_t)newtime.tv_sec * 1000000L);
@@ -1104,35 +2119,398 @@ bool NTPClient::adjustOffset (timeval* offset) {
     // }
 
     if (settimeofday (&newtime, (timezone*)NULL)) { // hard adjustment
+        unlockClock ();
+        NTP_TRACE_POINT (traceAdjustDone, 0, 0);
         return false;
     }
+    movedCorrection += clockCorrection + offset_us; // Clock filter refers stored samples to new clock with it
+    clockCorrection = 0;
     //Serial.printf ("millis() offset 1: %lld\n", currenttime_us / 1000 - millis ());
     //Serial.printf ("millis() offset 2: %lld\n", newtime_us / 1000 - millis ());
     DEBUGLOGD ("Offset: %lld", (newtime_us - currenttime_us));
-    //Serial.printf ("Requested offset %ld.%ld\n", offset->tv_sec, offset->tv_usec);
     //Serial.printf ("Requested new time %ld.%ld\n", newtime.tv_sec, newtime.tv_usec);
     //Serial.printf ("Requested new time %s\n", ctime (&(newtime.tv_sec)));
 
     DEBUGLOGI ("Hard adjust");
 
-    lastSyncd = newtime;
+    publishTimeBase (true);
+    unlockClock ();
+    getCorrectedTime (&lastSyncd);
+    NTP_TRACE_POINT (traceAdjustDone, 0, 1);
     DEBUGLOGI ("Offset adjusted");
     return true;
 }
 
+void NTPClient::notifyEvent (const NTPEvent_t& event) {
+    if (eventQueueEnabled) {
+        enqueueEvent (event.event < 0 ? &errorEventQueue : &eventQueue, event);
+    } else if (onSyncEvent) {
+        onSyncEvent (event);
+    }
+}
+
+bool NTPClient::enqueueEvent (NTPEventQueue_t* queue, const NTPEvent_t& event) {
+    uint32_t position = queue->head.load (std::memory_order_relaxed);
+    NTPEventSlot_t* slot;
+
+    for (;;) {
+        slot = &(queue->slots[position & (EVENT_QUEUE_SIZE - 1)]);
+        int32_t difference = (int32_t)(slot->sequence.load (std::memory_order_acquire) - position);
+        if (difference == 0) { // Slot is free, try to claim it
+            if (queue->head.compare_exchange_weak (position, position + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (difference < 0) { // Consumer has not read this slot yet
+            queue->dropped.fetch_add (1, std::memory_order_relaxed);
+            return false;
+        } else { // Another producer got this position
+            position = queue->head.load (std::memory_order_relaxed);
+        }
+    }
+    slot->event = event;
+    slot->sequence.store (position + 1, std::memory_order_release);
+    return true;
+}
+
+bool NTPClient::dequeueEvent (NTPEventQueue_t* queue, NTPEvent_t* event) {
+    NTPEventSlot_t* slot = &(queue->slots[queue->tail & (EVENT_QUEUE_SIZE - 1)]);
+
+    if (slot->sequence.load (std::memory_order_acquire) != queue->tail + 1) {
+        return false;
+    }
+    *event = slot->event;
+    slot->sequence.store (queue->tail + EVENT_QUEUE_SIZE, std::memory_order_release); // Free for next round
+    queue->tail++;
+    return true;
+}
+
+void NTPClient::resetEventQueue (NTPEventQueue_t* queue) {
+    for (unsigned int i = 0; i < EVENT_QUEUE_SIZE; i++) {
+        queue->slots[i].sequence.store (i, std::memory_order_relaxed);
+    }
+    queue->head.store (0, std::memory_order_relaxed);
+    queue->tail = 0;
+    queue->dropped.store (0, std::memory_order_release);
+}
+
+void NTPClient::setEventQueue (bool enable) {
+    if (enable && !eventQueueEnabled) {
+        resetEventQueue (&eventQueue);
+        resetEventQueue (&errorEventQueue);
+    }
+    eventQueueEnabled = enable;
+}
+
+bool NTPClient::getNextEvent (NTPEvent_t* event) {
+    if (!eventQueueEnabled) {
+        return false;
+    }
+    return dequeueEvent (&errorEventQueue, event) || dequeueEvent (&eventQueue, event);
+}
+
+size_t NTPClient::getEvents (NTPEvent_t* events, size_t maxEvents) {
+    size_t count = 0;
+
+    while (count < maxEvents && getNextEvent (&(events[count]))) {
+        count++;
+    }
+    return count;
+}
+
+unsigned int NTPClient::handleEvents (unsigned int maxEvents) {
+    NTPEvent_t event;
+    unsigned int count = 0;
+
+    while ((!maxEvents || count < maxEvents) && getNextEvent (&event)) {
+        if (onSyncEvent) {
+            onSyncEvent (event);
+        }
+        count++;
+    }
+    return count;
+}
+
+void NTPClient::accountStateTime () {
+    uint32_t now = ::millis ();
+    NTPMetric_t metric;
+
+    switch (status) {
+    case syncd:
+        metric = metricSyncdMs;
+        break;
+    case partialSync:
+        metric = metricPartialSyncMs;
+        break;
+    default:
+        metric = metricUnsyncdMs;
+    }
+    countMetric (metric, now - lastStateAccount);
+    lastStateAccount = now;
+}
+
+void NTPClient::getMetrics (NTPMetrics_t* metrics) {
+    for (unsigned int i = 0; i < metricCount; i++) {
+        metrics->counters[i] = metricCounters[i].load (std::memory_order_relaxed);
+    }
+    for (unsigned int i = 0; i < histogramCount; i++) {
+        for (unsigned int bin = 0; bin < METRICS_HISTOGRAM_BINS; bin++) {
+            metrics->histograms[i][bin] = metricHistograms[i][bin].load (std::memory_order_relaxed);
+        }
+    }
+}
+
+void NTPClient::resetMetrics () {
+    for (unsigned int i = 0; i < metricCount; i++) {
+        metricCounters[i].store (0, std::memory_order_relaxed);
+    }
+    for (unsigned int i = 0; i < histogramCount; i++) {
+        for (unsigned int bin = 0; bin < METRICS_HISTOGRAM_BINS; bin++) {
+            metricHistograms[i][bin].store (0, std::memory_order_relaxed);
+        }
+    }
+}
+
+const char* NTPClient::metricName (NTPMetric_t metric) {
+    static const char* const names[metricCount] = {
+        "requests_sent",
+        "send_errors",
+        "responses",
+        "timeouts",
+        "syncs",
+        "rejected_malformed",
+        "rejected_unknown_origin",
+        "rejected_bad_source",
+        "rejected_late",
+        "rejected_leap",
+        "rejected_version",
+        "rejected_mode",
+        "rejected_stratum",
+        "rejected_precision",
+        "rejected_dispersion",
+        "dns_queries",
+        "dns_errors",
+        "unsyncd_ms",
+        "partial_sync_ms",
+        "syncd_ms"
+    };
+    return metric < metricCount ? names[metric] : "unknown";
+}
+
+const char* NTPClient::histogramName (NTPHistogram_t histogram) {
+    static const char* const names[histogramCount] = {
+        "rtt_us",
+        "offset_us",
+        "dns_latency_ms"
+    };
+    return histogram < histogramCount ? names[histogram] : "unknown";
+}
+
+void NTPClient::syncSystemClock () {
+    timeval currentTime;
+
+    lockClock ();
+    int64_t now = monotonicMicros ();
+    gettimeofday (&currentTime, NULL);
+    int64_t systemTime = (int64_t)currentTime.tv_sec * 1000000L + (int64_t)currentTime.tv_usec;
+    int64_t correction = getClockCorrection (now);
+
+    // Library time only follows system time when it is changed outside library, so that it stays continuous
+    int64_t difference = systemTime + correction - timeBaseMicros (&timeBase, now);
+    if (difference >= EXTERNAL_STEP_THRESHOLD || difference <= -EXTERNAL_STEP_THRESHOLD) {
+        DEBUGLOGW ("System time changed %lld us outside library", difference);
+        publishTimeBase (true);
+    } else if (correction >= SYSTEM_CLOCK_TOLERANCE || correction <= -SYSTEM_CLOCK_TOLERANCE) {
+        int64_t newtime_us = systemTime + correction + (monotonicMicros () - now);
+        currentTime.tv_sec = newtime_us / 1000000L;
+        currentTime.tv_usec = newtime_us - ((int64_t)currentTime.tv_sec * 1000000L);
+        if (!settimeofday (&currentTime, (timezone*)NULL)) {
+            // Correction is set again from time base, so that error of this step does not accumulate
+            int64_t previous = getClockCorrection (monotonicMicros ());
+            correctionRef = monotonicMicros ();
+            gettimeofday (&currentTime, NULL);
+            clockCorrection = timeBaseMicros (&timeBase, correctionRef) - (int64_t)currentTime.tv_sec * 1000000L - (int64_t)currentTime.tv_usec;
+            movedCorrection += previous - clockCorrection; // Total correction does not change
+            DEBUGLOGV ("Moved %lld us to system clock", correction);
+        }
+    }
+    unlockClock ();
+}
+
+void NTPClient::publishTimeBase (bool stepped) {
+    timeval currentTime;
+    int64_t anchor = 0;
+    int64_t systemTime = 0;
+
+    // System time takes a lock, so it cannot be read inside critical section
+    stepped = stepped || !timeBaseSequence.load (std::memory_order_relaxed);
+    if (stepped) {
+        anchor = monotonicMicros ();
+        gettimeofday (&currentTime, NULL);
+        systemTime = (int64_t)currentTime.tv_sec * 1000000L + (int64_t)currentTime.tv_usec;
+    }
+
+    // Interrupts are disabled so that a reader on an ISR never spins on an unfinished update
+#ifdef ESP32
+    portENTER_CRITICAL (&timeBaseMux);
+#else
+    noInterrupts ();
+#endif
+    NTPTimeBase_t base;
+    if (stepped) {
+        base.monotonic = anchor;
+        base.utc = systemTime + getClockCorrection (anchor);
+    } else {
+        base.monotonic = monotonicMicros ();
+        base.utc = timeBaseMicros (&timeBase, base.monotonic);
+    }
+    base.frequency = clockFrequency;
+    base.slewRate = slewRate;
+    base.slewEnd = slewEnd;
+
+    uint32_t sequence = timeBaseSequence.load (std::memory_order_relaxed);
+    timeBaseSequence.store (sequence + 1, std::memory_order_relaxed); // Odd, readers retry
+    std::atomic_thread_fence (std::memory_order_release);
+    timeBase = base;
+    timeBaseSequence.store (sequence + 2, std::memory_order_release);
+#ifdef ESP32
+    portEXIT_CRITICAL (&timeBaseMux);
+#else
+    interrupts ();
+#endif
+}
+
+void NTPClient::addClockFilterSample (int64_t offsetNs, int64_t delayNs, NTPPacket_t* ntpPacket) {
+    // Shift register. Oldest sample is discarded
+    for (unsigned int i = CLOCK_FILTER_SIZE - 1; i > 0; i--) {
+        clockFilter[i] = clockFilter[i - 1];
+    }
+    NTPSample_t* sample = &(clockFilter[0]);
+    sample->offset = offsetNs;
+    sample->delay = delayNs < 0 ? 0 : delayNs;
+    // Server precision plus frequency tolerance during round trip
+    sample->dispersion = (int64_t)(ntpPacket->clockPrecission () * 1000000000.0) + sample->delay * CLOCK_FILTER_PHI / 1000000;
+    sample->time = monotonicMicros ();
+    sample->correction = getTotalCorrection ();
+    if (numSamples < CLOCK_FILTER_SIZE) {
+        numSamples++;
+    }
+}
+
+bool NTPClient::getFilteredOffset (int64_t* offset) {
+    if (!numSamples) {
+        return false;
+    }
+
+    int64_t correction = getTotalCorrection ();
+
+    if (offsetFilter == averageFilter) {
+        // Average of samples got during this sync
+        unsigned int count = round < numSamples ? round : numSamples;
+        if (!count) {
+            count = 1;
+        }
+        int64_t offsetSum = 0;
+        int64_t delaySum = 0;
+        for (unsigned int i = 0; i < count; i++) {
+            offsetSum += clockFilterOffset (&(clockFilter[i]), correction);
+            delaySum += clockFilter[i].delay;
+        }
+        delay = delaySum / count;
+        jitter = 0;
+        lastFilterSample = clockFilter[0].time;
+        *offset = offsetSum / count;
+        return true;
+    }
+
+    unsigned int selected = selectClockFilterSample (clockFilter, numSamples, monotonicMicros ());
+    jitter = clockFilterJitter (clockFilter, numSamples, selected, correction);
+    delay = clockFilter[selected].delay;
+    *offset = clockFilterOffset (&(clockFilter[selected]), correction);
+    DEBUGLOGD ("Selected sample %u of %u. Delay %lld ns", selected, numSamples, delay);
+
+    // Older sample was already used or it was worse than the one that was used then
+    if (clockFilter[selected].time <= lastFilterSample) {
+        DEBUGLOGI ("Clock filter selected an old sample");
+        return false;
+    }
+    lastFilterSample = clockFilter[selected].time;
+    return true;
+}
+
+void NTPClient::skipClockUpdate () {
+    DEBUGLOGI ("No new sample. Clock is not updated");
+    actualInterval = status == syncd ? getSyncdInterval () : shortInterval;
+}
+
+void NTPClient::updateFrequency (int64_t offsetUs, bool applied) {
+    if (!frequencyDiscipline) {
+        return;
+    }
+
+    int64_t now = monotonicMicros ();
+
+    if (abs (offsetUs) >= slewPanicThreshold) {
+        // A clock step breaks phase history, so it is not used to estimate frequency
+        DEBUGLOGI ("Offset too big for frequency estimation");
+        lastFrequencySample = applied ? now : 0;
+        frequencyResidual = 0;
+        return;
+    }
+
+    if (lastFrequencySample) {
+        int64_t mu = now - lastFrequencySample;
+        if (mu < MIN_FREQUENCY_SAMPLE_INTERVAL * 1000000LL) {
+            DEBUGLOGD ("Offsets too close for frequency estimation");
+            if (applied) {
+                lastFrequencySample = now;
+                frequencyResidual = 0;
+            }
+            return;
+        }
+        // Phase error that was expected without drift: uncorrected offset plus pending slew
+        int64_t drift = offsetUs - frequencyResidual - getSlewRemainingUs ();
+        double fll = (double)drift / (double)mu / FLL_AVERAGE;
+        double pll = (double)offsetUs / (double)mu / PLL_GAIN;
+        int64_t frequency = clockFrequency + (int64_t)((fll + pll) * 1000000000.0);
+        if (frequency > MAX_FREQUENCY_CORRECTION) {
+            frequency = MAX_FREQUENCY_CORRECTION;
+        } else if (frequency < -MAX_FREQUENCY_CORRECTION) {
+            frequency = -MAX_FREQUENCY_CORRECTION;
+        }
+        frequencyChange = frequency - clockFrequency;
+        double change = (double)frequencyChange;
+        frequencyWander = sqrt (frequencyWander * frequencyWander + (change * change - frequencyWander * frequencyWander) / FLL_AVERAGE);
+        
+        lockClock ();
+        foldClockCorrection (now);
+        clockFrequency = frequency;
+        publishTimeBase ();
+        unlockClock ();
+        DEBUGLOGI ("Frequency correction %0.3f ppm. Wander %0.3f ppm", getFrequencyPpm (), getFrequencyWanderPpm ());
+    }
+    lastFrequencySample = now;
+    frequencyResidual = applied ? 0 : offsetUs;
+}
+
 char* NTPClient::ntpEvent2str (NTPEvent_t e) {
-    const int resultMaxSize = 150;
-    static char result[resultMaxSize];
+    static char result[EVENT_STR_LENGTH];
+    return ntpEvent2str (e, result, sizeof (result));
+}
+
+char* NTPClient::ntpEvent2str (NTPEvent_t e, char* result, size_t resultMaxSize) {
+    char timeStr[TIME_DATE_STR_LENGTH];
+
     switch (e.event) {
     case timeSyncd:
-        snprintf (result, resultMaxSize, "%d:    Got NTP time %s from %s:%u. Offset: %0.3f ms. Delay: %0.3f ms. Dispersion: %0.3f ms",
+        snprintf (result, resultMaxSize, "%d:    Got NTP time %s from %s:%u. Offset: %0.3f ms. Delay: %0.3f ms. Dispersion: %0.3f ms%s",
                   e.event,
-                  NTP.getTimeDateStringUs (),
+                  getTimeDateStringUs (timeStr, sizeof (timeStr)),
                   e.info.serverAddress.toString ().c_str (),
                   e.info.port,
                   e.info.offset * 1000,
                   e.info.delay * 1000,
-                  e.info.dispersion * 1000);
+                  e.info.dispersion * 1000,
+                  e.info.slewing ? ". Slewing" : "");
         break;
     case noResponse:
         snprintf (result, resultMaxSize, "%d:   No response from NTP server %s:%u",
@@ -1160,7 +2538,7 @@ char* NTPClient::ntpEvent2str (NTPEvent_t e) {
         snprintf (result, resultMaxSize, "%d: #%u Partial sync %s from %s:%u. Offset: %0.3f ms. Delay: %0.3f ms. Dispersion: %0.3f ms",
                   e.event,
                   e.info.retrials,
-                  NTP.getTimeDateStringUs (),
+                  getTimeDateStringUs (timeStr, sizeof (timeStr)),
                   e.info.serverAddress.toString ().c_str (),
                   e.info.port,
                   e.info.offset * 1000,
@@ -16,6 +16,7 @@
 #endif
 
 #include <functional>
+#include <atomic>
 //using namespace std;
 //using namespace placeholders;
 
@@ -35,6 +36,9 @@ extern "C" {
 #else
 #include "TZ.h"
 #endif
+#include "TimeZone.h"
+#include "TZdb.h"
+#include "ClockFilter.h"
 
 constexpr auto DEFAULT_NTP_SERVER = "pool.ntp.org"; ///< @brief Default international NTP server. I recommend you to select a closer server to get better accuracy
 constexpr auto DEFAULT_NTP_PORT = 123; ///< @brief Default local udp port. Select a different one if neccesary (usually not needed)
@@ -49,15 +53,46 @@ constexpr auto DEFAULT_MAX_RESYNC_RETRY = 3; ///< @brief Maximum number of sync
 constexpr auto DEAULT_NUM_TIMEOUTS = 3; ///< @brief After this number of timeouts there is no more continiuos
 #ifdef ESP8266
 constexpr auto ESP8266_LOOP_TASK_INTERVAL = 500; ///< @brief Loop task period on ESP8266
-constexpr auto ESP8266_RECEIVER_TASK_INTERVAL = 100; ///< @brief Receiver task period on ESP8266
 #endif // ESP8266
 constexpr auto DEFAULT_TIME_SYNC_THRESHOLD = 2500; ///< @brief If calculated offset is less than this in us clock will not be corrected
 constexpr auto DEFAULT_NUM_OFFSET_AVE_ROUNDS = 1; ///< @brief Number of NTP request and response rounds to calculate offset average
 constexpr auto MAX_OFFSET_AVERAGE_ROUNDS = 5; ///< @brief Maximum number of NTP request for offset average calculation
+constexpr auto DEFAULT_BURST_SIZE = 4; ///< @brief Number of requests sent on every sync in burst mode
+constexpr auto MAX_BURST_SIZE = 8; ///< @brief Maximum number of requests in a burst
+constexpr auto DEFAULT_BURST_SPACING = 250; ///< @brief Time between burst requests in milliseconds
+constexpr auto MAX_PENDING_REQUESTS = 8; ///< @brief Size of outstanding request table
+constexpr auto TRANSMIT_RANDOM_BITS = 12; ///< @brief Low fraction bits of transmit timestamp that are randomized. Below 1 us resolution
+constexpr auto DEFAULT_SLEW_WINDOW = 60; ///< @brief Time to amortize a clock correction in slew mode, in seconds
+constexpr auto DEFAULT_SLEW_PANIC_THRESHOLD = 128000; ///< @brief Offsets over this value in us are applied as a step even in slew mode
+constexpr auto SYSTEM_CLOCK_TOLERANCE = 1000; ///< @brief Slew and frequency correction is moved to system clock when it reaches this value in us
+constexpr auto EXTERNAL_STEP_THRESHOLD = 1000; ///< @brief Difference between system time and library time, in us, that is taken as a change done outside library
+constexpr auto MIN_FREQUENCY_SAMPLE_INTERVAL = 60; ///< @brief Minimum time between offsets to use them for frequency estimation, in seconds
+constexpr auto MAX_FREQUENCY_CORRECTION = 500000; ///< @brief Maximum frequency correction, in ppb (500 ppm)
+constexpr auto FLL_AVERAGE = 4; ///< @brief Averaging constant for frequency error calculated from successive offsets
+constexpr auto PLL_GAIN = 16; ///< @brief Divisor for frequency error calculated from a single offset
+constexpr auto DEFAULT_MIN_POLL_EXPONENT = 6; ///< @brief Minimum adaptive sync interval as log2 seconds. 64 seconds
+constexpr auto DEFAULT_MAX_POLL_EXPONENT = 14; ///< @brief Maximum adaptive sync interval as log2 seconds. 16384 seconds, about 4.5 hours
+constexpr auto MAX_POLL_EXPONENT = 17; ///< @brief Highest allowed adaptive sync interval as log2 seconds. 131072 seconds, about 36 hours
+constexpr auto POLL_HYSTERESIS_LIMIT = 30; ///< @brief Hysteresis counter limit to change adaptive sync interval
+
+constexpr auto RESPONSE_QUEUE_SIZE = 4; ///< @brief Number of received responses that may wait for the receiver task. Must be a power of 2
+constexpr auto EVENT_QUEUE_SIZE = 8; ///< @brief Number of events that may wait on every event queue to be handled by user code. Must be a power of 2
 
 constexpr auto TZNAME_LENGTH = 60; ///< @brief Max TZ name description length
 constexpr auto SERVER_NAME_LENGTH = 40; ///< @brief Max server name (FQDN) length
+constexpr auto TIME_STR_LENGTH = 16; ///< @brief Buffer size for time strings. `HH:MM:SS.uuuuuu`
+constexpr auto DATE_STR_LENGTH = 11; ///< @brief Buffer size for date strings. `dd/mm/yyyy`
+constexpr auto TIME_DATE_STR_LENGTH = 40; ///< @brief Buffer size for time and date strings. `dd/mm/yyyy HH:MM:SS.uuuuuu ZONE`
+constexpr auto UPTIME_STR_LENGTH = 24; ///< @brief Buffer size for uptime strings
+constexpr auto EVENT_STR_LENGTH = 170; ///< @brief Buffer size for event descriptions
+constexpr auto MAX_NTP_SERVERS = 4; ///< @brief Max number of servers queried on every sync, including main one
+constexpr auto METRICS_HISTOGRAM_BINS = 24; ///< @brief Number of log2 bins of metrics histograms. Last one has no upper limit
+constexpr auto MAX_TIME_ZONES = 4; ///< @brief Maximum number of registered time zones, besides system one
+constexpr auto DEFAULT_DNS_CACHE_LIFETIME = 3600; ///< @brief Time that a resolved server address is used before refreshing it, in seconds
+constexpr auto DNS_START_WAIT = 20; ///< @brief Maximum time that sync loop waits for network stack task to start a name resolution, in ms
 constexpr auto NTP_PACKET_SIZE = 48; ///< @brief NTP time is in the first 48 bytes of message
+constexpr auto SEVENTY_YEARS = 2208988800UL; ///< @brief Seconds from 1-Jan-1900 (NTP prime epoch) to 1-Jan-1970 (UNIX epoch)
+constexpr auto MIN_VALID_UNIX_TIME = 1577836800UL; ///< @brief 1-Jan-2020. Local clock before this time is considered not set
 
 /* Useful Constants */
 #ifndef SECS_PER_MIN
@@ -84,12 +119,15 @@ constexpr auto SECS_YR_2000 = ((time_t)(946684800UL)); ///< @brief The time at t
 
 #ifdef ESP32
 #include <WiFi.h>
+#include <esp_timer.h>
+#include "lwip/tcpip.h"
 #else
 #include <ESP8266WiFi.h>
 #endif
 #include <Ticker.h>
 
 #include "NTPEventTypes.h"
+#include "NTPTrace.h"
 
   /**
     * @brief NTP client status code
@@ -135,6 +173,51 @@ typedef struct {
     int mode;
 } NTPFlags_t;
 
+  /**
+    * @brief NTP timestamp in its native 32.32 fixed point format.
+    * 
+    * High 32 bits are seconds since 1-Jan-1900 00:00 UTC, low 32 bits are fraction of second (1/2^32)
+    */
+typedef uint64_t NTPTimestamp_t;
+
+  /**
+    * @brief NTP short format in 16.16 fixed point. Used for root delay and dispersion
+    */
+typedef uint32_t NTPShort_t;
+
+  /**
+    * @brief Converts a NTP timestamp to `timeval` UNIX time
+    * @param timestamp NTP timestamp
+    * @return UNIX time. Zero timestamp is kept as zero
+    */
+inline timeval ntpTimestamp2timeval (NTPTimestamp_t timestamp) {
+    timeval tv;
+    uint32_t seconds = timestamp >> 32;
+    tv.tv_sec = seconds ? (time_t)(uint32_t)(seconds - SEVENTY_YEARS) : 0;
+    tv.tv_usec = ((timestamp & 0xFFFFFFFFULL) * 1000000ULL) >> 32;
+    return tv;
+}
+
+  /**
+    * @brief Converts `timeval` UNIX time to NTP timestamp
+    * @param tv UNIX time
+    * @return NTP timestamp
+    */
+inline NTPTimestamp_t timeval2ntpTimestamp (timeval tv) {
+    uint32_t seconds = (uint32_t)tv.tv_sec + SEVENTY_YEARS;
+    uint32_t fraction = ((uint64_t)tv.tv_usec << 32) / 1000000ULL;
+    return ((NTPTimestamp_t)seconds << 32) | fraction;
+}
+
+  /**
+    * @brief Converts a NTP short format value to seconds
+    * @param value NTP short format value
+    * @return Value in seconds
+    */
+inline float ntpShort2float (NTPShort_t value) {
+    return (float)value / (float)0x10000;
+}
+
   /**
     * @brief NTP packet structure
     */
@@ -156,12 +239,12 @@ typedef struct {
     uint8_t peerStratum;
     
      /**
-      * @brief Maximum interval between successive messages, in seconds.
+      * @brief Maximum interval between successive messages, as 8-bit signed integer representing log2 seconds.
       *
-      * Calculated from 8-bit signed integer representing log2 value. Suggested default limits for 
-      * minimum and maximum poll intervals are 6 and 10, what represent 64 to 1024 seconds, respectively
+      * Suggested default limits for minimum and maximum poll intervals are 6 and 10, what represent
+      * 64 to 1024 seconds, respectively
       */
-    uint32_t pollingInterval;
+    int8_t pollingExponent;
     
     /**
       * @brief 8-bit signed integer representing the precision of the
@@ -171,11 +254,11 @@ typedef struct {
       * The precision can be determined when the service first starts up as the minimum
       * time of several iterations to read the system clock
       */
-    float clockPrecission;
+    int8_t precisionExponent;
        
-    float rootDelay; ///< @brief Total round-trip delay to the reference clock
+    NTPShort_t rootDelayRaw; ///< @brief Total round-trip delay to the reference clock, in NTP short format
     
-    float dispersion; ///< @brief Total dispersion to the reference clock
+    NTPShort_t dispersionRaw; ///< @brief Total dispersion to the reference clock, in NTP short format
     
      /**
       * @brief 32-bit code identifying the particular server or reference clock
@@ -221,26 +304,247 @@ typedef struct {
       */
     uint8_t refID[4];
     
-    timeval reference; ///< @brief Time when the system clock was last set or corrected
-    timeval origin; ///< @brief Time at the client when the request departed for the server
-    timeval receive; ///< @brief Time at the server when the request arrived from the client
-    timeval transmit; ///< @brief Time at the server when the response left for the client
-    timeval destination; ///< Time at the client when the reply arrived from the server, in NTP timestamp format
+    NTPTimestamp_t reference; ///< @brief Time when the system clock was last set or corrected
+    NTPTimestamp_t origin; ///< @brief Time at the client when the request departed for the server
+    NTPTimestamp_t receive; ///< @brief Time at the server when the request arrived from the client
+    NTPTimestamp_t transmit; ///< @brief Time at the server when the response left for the client
+    NTPTimestamp_t destination; ///< Time at the client when the reply arrived from the server
+
+    /**
+      * @brief Gets maximum interval between successive messages
+      * @return Polling interval in seconds
+      */
+    uint32_t pollingInterval () const {
+        return (pollingExponent >= 0 && pollingExponent < 32) ? (1UL << pollingExponent) : 0;
+    }
+
+    /**
+      * @brief Gets precision of the server clock
+      * @return Precision in seconds
+      */
+    float clockPrecission () const {
+        return ldexpf (1.0, precisionExponent);
+    }
+
+    /**
+      * @brief Gets total round-trip delay to the reference clock
+      * @return Root delay in seconds
+      */
+    float rootDelay () const {
+        return ntpShort2float (rootDelayRaw);
+    }
+
+    /**
+      * @brief Gets total dispersion to the reference clock
+      * @return Dispersion in seconds
+      */
+    float dispersion () const {
+        return ntpShort2float (dispersionRaw);
+    }
 } NTPPacket_t;
 
-typedef std::function<void (NTPEvent_t)> onSyncEvent_t; ///< @brief Event notifier callback
+  /**
+    * @brief Method to get offset from several NTP responses
+    */
+typedef enum {
+    minDelayFilter = 0, ///< @brief RFC5905 clock filter. Sample with minimum delay and dispersion is selected
+    averageFilter = 1   ///< @brief Arithmetic average of offsets got during last sync
+} NTPOffsetFilter_t;
+
+  /**
+    * @brief State of an outstanding request table entry
+    */
+typedef enum {
+    requestEntryFree,               ///< @brief Entry may be used
+    requestEntryReserved,           ///< @brief Entry is being filled by sender. Receiver does not read it
+    requestEntrySent                ///< @brief Entry is complete and may be matched by receiver
+} NTPRequestState_t;
+
+  /**
+    * @brief Request waiting for a response
+    */
+typedef struct {
+    std::atomic<uint8_t> state;     ///< @brief Entry state, as `NTPRequestState_t`. Fields below are published with a release store to `requestEntrySent`
+    NTPTimestamp_t transmit;        ///< @brief Transmit timestamp written on request. Response must carry it as origin
+    IPAddress address;              ///< @brief Server address. Response must come from it
+    int64_t expiry;                 ///< @brief Monotonic time after which a response is considered late, in microseconds
+    NTPTimestamp_t sendTime;        ///< @brief Local time when request was handed to network stack
+    std::atomic<uint32_t> sendLatency;  ///< @brief Time spent inside `udp_send`, in microseconds. It is added to `sendTime` to get T1. Zero until send returns
+    uint8_t server;                 ///< @brief Index of server on server set
+} NTPRequest_t;
+
+  /**
+    * @brief Time spent on every stage of a request and its response, in microseconds
+    */
+typedef struct {
+    int64_t request;                ///< @brief From poll start to request sent, including name resolution
+    int32_t prepare;                ///< @brief Request buffer preparation, before transmit timestamp is taken
+    int32_t send;                   ///< @brief `udp_send` call. Added to T1 if post send timestamp is enabled
+    int32_t dispatch;               ///< @brief From response arrival (T4) until receiver starts processing it
+    int32_t process;                ///< @brief Response decoding and offset calculation
+} NTPLatency_t;
+
+  /**
+    * @brief Counters of responses that have been discarded
+    */
+typedef struct {
+    uint32_t malformed;             ///< @brief Too short or not decodable
+    uint32_t unknownOrigin;         ///< @brief Origin timestamp does not match any sent request
+    uint32_t badSource;             ///< @brief Origin matches but source address or port are not the server's ones
+    uint32_t late;                  ///< @brief Response arrived after request lifetime or sync was finished
+} NTPRejectedResponses_t;
+
+  /**
+    * @brief Sync health counters. Every one wraps around at 2^32, so exporters should use differences between snapshots
+    */
+typedef enum {
+    metricRequestsSent,             ///< @brief Requests sent
+    metricSendErrors,               ///< @brief Requests that could not be sent
+    metricResponses,                ///< @brief Responses received, valid or not
+    metricTimeouts,                 ///< @brief Syncs finished with no response
+    metricSyncs,                    ///< @brief Successful syncs
+    metricRejectedMalformed,        ///< @brief Responses too short or not decodable
+    metricRejectedUnknownOrigin,    ///< @brief Responses whose origin timestamp does not match any sent request
+    metricRejectedBadSource,        ///< @brief Responses coming from an address or port that is not the server's one
+    metricRejectedLate,             ///< @brief Responses arrived after request lifetime or sync was finished
+    metricRejectedLeap,             ///< @brief Responses with leap indicator set
+    metricRejectedVersion,          ///< @brief Responses with NTP version other than 4
+    metricRejectedMode,             ///< @brief Responses with mode other than server
+    metricRejectedStratum,          ///< @brief Responses with invalid stratum
+    metricRejectedPrecision,        ///< @brief Responses from servers less precise than required accuracy
+    metricRejectedDispersion,       ///< @brief Responses with too high dispersion
+    metricDnsQueries,               ///< @brief Server name resolutions started
+    metricDnsErrors,                ///< @brief Server name resolutions failed
+    metricUnsyncdMs,                ///< @brief Time spent unsynchronized, in milliseconds
+    metricPartialSyncMs,            ///< @brief Time spent partially synchronized, in milliseconds
+    metricSyncdMs,                  ///< @brief Time spent synchronized, in milliseconds
+    metricCount                     ///< @brief Number of counters
+} NTPMetric_t;
+
+  /**
+    * @brief Sync health histograms. Bin 0 counts zero values and bin `n` counts values from 2^(n-1) to 2^n - 1
+    */
+typedef enum {
+    histogramRtt,                   ///< @brief Round trip delay of responses matched to a request, before validity and accuracy checks, in microseconds
+    histogramOffset,                ///< @brief Absolute offset of responses matched to a request, before validity and accuracy checks, in microseconds
+    histogramDnsLatency,            ///< @brief Server name resolution time, in milliseconds
+    histogramCount                  ///< @brief Number of histograms
+} NTPHistogram_t;
+
+  /**
+    * @brief Snapshot of sync health metrics
+    */
+typedef struct {
+    uint32_t counters[metricCount]; ///< @brief Counters, indexed by `NTPMetric_t`
+    uint32_t histograms[histogramCount][METRICS_HISTOGRAM_BINS]; ///< @brief Histograms, indexed by `NTPHistogram_t`
+} NTPMetrics_t;
+
+  /**
+    * @brief Name resolution state of a server. Sync loop starts a resolution and collects its result.
+    * Network stack task runs it
+    */
+typedef enum {
+    dnsIdle,                        ///< @brief No resolution in progress
+    dnsQueued,                      ///< @brief Resolution requested to network stack task
+    dnsInProgress,                  ///< @brief Waiting for DNS server response
+    dnsResolved,                    ///< @brief Address got. Waiting to be collected by sync loop
+    dnsError                        ///< @brief Resolution failed. Waiting to be collected by sync loop
+} NTPDnsState_t;
+
+  /**
+    * @brief State of a server on server set
+    */
+typedef struct {
+    IPAddress address;              ///< @brief Last known good address of server name
+    bool addressValid;              ///< @brief `address` has been resolved at least once
+    int64_t addressExpiry;          ///< @brief Monotonic time when address has to be resolved again, in microseconds
+    bool dnsFailed;                 ///< @brief Last name resolution failed
+    std::atomic<uint8_t> dnsState;  ///< @brief Name resolution state, as `NTPDnsState_t`. Fields below are owned by network stack task while it is `dnsQueued` or `dnsInProgress`
+    char queryName[SERVER_NAME_LENGTH]; ///< @brief Name being resolved
+    uint32_t resolvedAddress;       ///< @brief Resolved IPv4 address, valid in `dnsResolved` state
+    uint32_t resolveStart;          ///< @brief `millis()` when last name resolution was started
+    bool answered;                  ///< @brief Valid response has been got for last request
+    bool rejected;                  ///< @brief Not valid response has been got for last request
+    int64_t offset;                 ///< @brief Offset got from last response, in nanoseconds
+    int64_t delay;                  ///< @brief Round trip delay of last response, in nanoseconds
+    int64_t distance;               ///< @brief Root distance of last response, in nanoseconds. Half width of correctness interval
+    NTPPacket_t packet;             ///< @brief Last response
+} NTPServer_t;
+
+  /**
+    * @brief Received NTP response waiting for the receiver task
+    */
+typedef struct {
+    pbuf* packet;                   ///< @brief UDP response packet
+    timeval destination;            ///< @brief Time at the client when the response arrived
+    int64_t received;               ///< @brief Monotonic time when the response arrived, in microseconds
+    ip_addr_t address;              ///< @brief Address the response came from
+    uint16_t port;                  ///< @brief Port the response came from
+} NTPResponse_t;
+
+  /**
+    * @brief Event queue slot. `sequence` tells if slot is free for producers or ready for consumer
+    */
+typedef struct {
+    std::atomic<uint32_t> sequence; ///< @brief Position this slot is ready for. Equal to write position when free, one more when written
+    NTPEvent_t event;               ///< @brief Queued event
+} NTPEventSlot_t;
 
-static char strBuffer[35]; ///< @brief Temporary buffer for time and date strings
+  /**
+    * @brief Bounded lock free event queue. Several producers, on any task or timer context, and one consumer
+    */
+typedef struct {
+    NTPEventSlot_t slots[EVENT_QUEUE_SIZE]; ///< @brief Queued events
+    std::atomic<uint32_t> head;     ///< @brief Next write position. Claimed by producers with compare and swap
+    uint32_t tail;                  ///< @brief Next read position. Only used by consumer
+    std::atomic<uint32_t> dropped;  ///< @brief Number of events dropped because queue was full
+} NTPEventQueue_t;
+
+  /**
+    * @brief Relation between monotonic counter and library time. Published by sync process and read by
+    * `NTP.micros()` without locks nor system calls
+    */
+typedef struct {
+    int64_t monotonic;              ///< @brief Monotonic counter reading, in microseconds
+    int64_t utc;                    ///< @brief Corrected time at `monotonic`, in microseconds since 1-Jan-1970 00:00 UTC
+    int64_t frequency;              ///< @brief Frequency correction, in ppb
+    int64_t slewRate;               ///< @brief Slew rate, in ppb
+    int64_t slewEnd;                ///< @brief Monotonic time when slew finishes, in microseconds
+} NTPTimeBase_t;
+
+  /**
+    * @brief Local time breakdown of the minute in use by formatters. Any second inside it is got adding
+    * seconds to `minute` without calling `localtime`
+    */
+typedef struct {
+    time_t start;                   ///< @brief UNIX time when local minute starts
+    tm minute;                      ///< @brief Local time breakdown at `start`. `tm_sec` is always 0
+    uint32_t generation;            ///< @brief Time zone generation this breakdown was calculated with
+} NTPLocalTimeCache_t;
+
+  /**
+    * @brief Gets a monotonic microseconds counter that is not affected by clock adjustments
+    * @return Microseconds since boot
+    */
+inline int64_t monotonicMicros () {
+#ifdef ESP32
+    return esp_timer_get_time ();
+#else
+    return micros64 ();
+#endif
+}
+
+typedef std::function<void (NTPEvent_t)> onSyncEvent_t; ///< @brief Event notifier callback
 
 /**
   * @brief NTPClient class
   */
 class NTPClient {
 protected:
+    static char strBuffer[TIME_DATE_STR_LENGTH]; ///< @brief Shared buffer for time and date strings of functions without buffer argument
     udp_pcb* udp;                   ///< @brief UDP connection object
     timeval lastSyncd;              ///< @brief Stored time of last successful sync
     timeval firstSync;              ///< @brief Stored time of first successful sync after boot
-    timeval packetLastReceived;     ///< @brief Moment when a NTP response has arrived
     bool ntpRequested = false;      ///< @brief Indicates that a NTP response is pending
     unsigned long uptime = 0;       ///< @brief Time since boot
     unsigned int shortInterval = DEFAULT_NTP_SHORTINTERVAL * 1000;  ///< @brief Interval to set periodic time sync until first synchronization.
@@ -267,23 +571,325 @@ public:
     TaskHandle_t receiverHandle = NULL;                             ///< @brief NTP response receiver task handle
 #else
     Ticker loopTimer;               ///< @brief Timer to trigger timesync
-    Ticker receiverTimer;           ///< @brief Timer to check received responses
+    bool receiverScheduled = false; ///< @brief Receiver poll function is registered on scheduler. It is registered only once
 #endif
 protected:
     Ticker responseTimer;           ///< @brief Timer to trigger response timeout
+    Ticker burstTimer;              ///< @brief Timer to send burst requests
+    std::atomic<bool> timeoutPending {false};  ///< @brief Response timer expired and timeout is waiting to be processed from loop. Only used on ESP8266
+    bool burstEnabled = false;      ///< @brief Burst mode. Several requests are sent on every sync
+    unsigned int burstSize = DEFAULT_BURST_SIZE;    ///< @brief Number of requests in a burst
+    int burstSpacing = DEFAULT_BURST_SPACING;       ///< @brief Time between burst requests in milliseconds
+    volatile unsigned int burstSent = 0;            ///< @brief Number of requests sent during current burst
+    volatile unsigned int burstExpected = 0;        ///< @brief Number of responses that finish current burst
+    unsigned int burstReceived = 0;                 ///< @brief Number of valid responses got during current burst
+    volatile bool syncTimedOut = false;             ///< @brief Burst or server set timeout is pending to be processed by receiver
+    NTPPacket_t lastBurstPacket;                    ///< @brief Last response of current burst, used to check server quality
+    char serverNames[MAX_NTP_SERVERS - 1][SERVER_NAME_LENGTH];     ///< @brief Names of additional servers. Main server is `ntpServerName`
+    NTPServer_t servers[MAX_NTP_SERVERS];           ///< @brief Server set state. First one is main server
+    uint8_t numServers = 1;                         ///< @brief Number of servers in server set, including main one
+    std::atomic<unsigned int> serverRequests {0};   ///< @brief Number of requests sent to server set during current sync
+    std::atomic<unsigned int> serverPending {0};    ///< @brief Responses still expected plus one while requests are being sent. Whoever takes it to 0 finishes sync
+    int64_t dnsCacheLifetime = DEFAULT_DNS_CACHE_LIFETIME * 1000000LL;  ///< @brief Time that a resolved address is used, in microseconds
+    unsigned int dnsErrors = 0;                     ///< @brief Consecutive name resolution errors
+    NTPLatency_t latency = {};                      ///< @brief Stage latencies of last request
+    pbuf* requestBuffer = NULL;                     ///< @brief Preformatted request buffer, reused on every send
+    void* requestPayload = NULL;                    ///< @brief Start of request on `requestBuffer`, before network stack adds headers
+    bool postSendTimestamp = true;                  ///< @brief T1 is corrected with time spent inside `udp_send`
+    NTPRequest_t pendingRequests[MAX_PENDING_REQUESTS];             ///< @brief Outstanding request table
+    bool randomizeTransmit = true;                  ///< @brief Fill transmit timestamp bits under clock resolution with random data
+    std::atomic<uint32_t> metricCounters[metricCount] = {};  ///< @brief Sync health counters
+    std::atomic<uint32_t> metricHistograms[histogramCount][METRICS_HISTOGRAM_BINS] = {};  ///< @brief Sync health histograms
+    uint32_t lastStateAccount = 0;  ///< @brief `millis()` when time spent on current sync state was last accounted
+    std::atomic<unsigned int> serverResponses {0};    ///< @brief Number of responses got from server set during current sync
     bool isConnected = false;       ///< @brief True if client has resolved correctly server IP address
-    double offset;                  ///< @brief Temporary offset storage for event notify
-    double delay;                   ///< @brief Temporary delay storage for event notify
+    int64_t offset;                 ///< @brief Temporary offset storage for event notify, in nanoseconds
+    int64_t delay;                  ///< @brief Temporary delay storage for event notify, in nanoseconds
     timezone timeZone;              ///< @brief 
     char tzname[TZNAME_LENGTH];     ///< @brief Configuration string for local time zone
     
-    int64_t offsetSum;              ///< @brief Sum of offsets for average calculation
-    int64_t offsetAve;              ///< @brief Average calculated value
+    int64_t filteredOffset;         ///< @brief Offset got from clock filter, in nanoseconds
+    int64_t jitter = 0;             ///< @brief RMS of differences between filtered offset and other samples, in nanoseconds
     unsigned int round = 0;                 ///< @brief Number of offset values added during last sync 
     unsigned int numAveRounds = DEFAULT_NUM_OFFSET_AVE_ROUNDS;          ///< @brief Number of request to be done to calculate average.
+    NTPOffsetFilter_t offsetFilter = minDelayFilter;    ///< @brief Method to get offset from samples
+    NTPSample_t clockFilter[CLOCK_FILTER_SIZE];         ///< @brief Last samples, newest first
+    unsigned int numSamples = 0;    ///< @brief Number of valid samples in `clockFilter`
+    int64_t lastFilterSample = 0;   ///< @brief Monotonic time of last sample used by clock filter, in us
     
-    pbuf* lastNtpResponsePacket;    ///< @brief Last response packet to be processed by receiver task
-    bool responsePacketValid = false;                           ///< @brief Is `lastNtpResponsePacket` already processed?
+    /**
+      * @brief Adds a new sample to clock filter
+      * @param offsetNs Measured offset in nanoseconds
+      * @param delayNs Measured round trip delay in nanoseconds
+      * @param ntpPacket Response packet, used to get sample dispersion
+      */
+    void addClockFilterSample (int64_t offsetNs, int64_t delayNs, NTPPacket_t* ntpPacket);
+    
+    /**
+      * @brief Gets offset from clock filter samples using selected method. Updates `delay` and `jitter`.
+      * Minimum delay filter selects among all samples, and as in RFC5905 a sample is never used twice
+      * @param offset Storage for filtered offset in nanoseconds
+      * @return `false` if selected sample is not newer than last used one, so clock must not be updated
+      */
+    bool getFilteredOffset (int64_t* offset);
+    
+    /**
+      * @brief Programs next sync without updating clock, when clock filter gives no new sample
+      */
+    void skipClockUpdate ();
+    
+    NTPResponse_t responseQueue[RESPONSE_QUEUE_SIZE];   ///< @brief Responses to be processed by receiver task. Written only by `s_recvPacket`
+    std::atomic<uint32_t> responseQueueHead {0};        ///< @brief Number of responses queued. Written only by `s_recvPacket`
+    std::atomic<uint32_t> responseQueueTail {0};        ///< @brief Number of responses processed. Written only by receiver task
+    uint32_t responseQueueOverflows = 0;                ///< @brief Number of responses dropped because queue was full
+    
+    bool eventQueueEnabled = false; ///< @brief If true, events are queued to be handled from user loop instead of calling handler at once
+    NTPEventQueue_t eventQueue;     ///< @brief Queued events other than errors
+    NTPEventQueue_t errorEventQueue; ///< @brief Queued error events. Handled before other ones
+    
+    /**
+      * @brief Checks if events have to be built, because there is a handler or they are queued
+      * @return `true` if events are used
+      */
+    bool eventsEnabled () {
+        return eventQueueEnabled || onSyncEvent;
+    }
+    
+    /**
+      * @brief Delivers an event. It is queued if event queue is enabled or handler is called at once otherwise
+      * @param event Event to deliver
+      */
+    void notifyEvent (const NTPEvent_t& event);
+    
+    /**
+      * @brief Adds an event to a queue. Lock free and allocation free, so it may be called from any context
+      * @param queue Event queue
+      * @param event Event to add
+      * @return `false` if queue was full. Event is dropped in that case
+      */
+    bool enqueueEvent (NTPEventQueue_t* queue, const NTPEvent_t& event);
+    
+    /**
+      * @brief Gets oldest event from a queue. Only one task may consume events
+      * @param queue Event queue
+      * @param event Storage for event
+      * @return `false` if queue was empty
+      */
+    bool dequeueEvent (NTPEventQueue_t* queue, NTPEvent_t* event);
+    
+    /**
+      * @brief Empties an event queue
+      * @param queue Event queue
+      */
+    void resetEventQueue (NTPEventQueue_t* queue);
+    
+    bool slewEnabled = false;                                       ///< @brief If true, offsets under `slewPanicThreshold` are applied gradually
+    int64_t slewWindow = DEFAULT_SLEW_WINDOW * 1000000LL;           ///< @brief Time to amortize a correction, in us
+    long slewPanicThreshold = DEFAULT_SLEW_PANIC_THRESHOLD;         ///< @brief Offsets over this value in us are always applied as a step
+    int64_t clockCorrection = 0;    ///< @brief Correction added to system time by the library at `correctionRef` and not moved to system clock yet, in us
+    int64_t movedCorrection = 0;    ///< @brief Correction moved to system clock or stepped since start, in us. Added to `clockCorrection` it gives total correction
+    int64_t correctionRef = 0;      ///< @brief Monotonic time when `clockCorrection` was calculated, in us
+    int64_t slewRate = 0;           ///< @brief Rate at which current slew is applied, in ppb
+    int64_t slewEnd = 0;            ///< @brief Monotonic time when current slew finishes, in us
+    
+    bool frequencyDiscipline = false;   ///< @brief If true, local oscillator frequency error is estimated and compensated
+    int32_t clockFrequency = 0;     ///< @brief Frequency correction applied to library time, in ppb
+    double frequencyWander = 0;     ///< @brief RMS of recent frequency corrections changes, in ppb
+    int64_t lastFrequencySample = 0;    ///< @brief Monotonic time of last offset used for frequency estimation, in us. 0 if none
+    int64_t frequencyResidual = 0;  ///< @brief Part of last offset that was not corrected, in us
+    int64_t frequencyChange = 0;    ///< @brief Last change of frequency correction, in ppb
+    
+    bool adaptivePoll = false;      ///< @brief If true, sync interval is adapted to measured offsets instead of using `longInterval`
+    uint8_t minPollExponent = DEFAULT_MIN_POLL_EXPONENT;    ///< @brief Minimum adaptive sync interval as log2 seconds
+    uint8_t maxPollExponent = DEFAULT_MAX_POLL_EXPONENT;    ///< @brief Maximum adaptive sync interval as log2 seconds
+    uint8_t pollExponent = DEFAULT_MIN_POLL_EXPONENT;       ///< @brief Current adaptive sync interval as log2 seconds
+    int pollHysteresis = 0;         ///< @brief Counter to avoid adaptive sync interval changing too often
+    
+#ifdef ESP32
+    StaticSemaphore_t clockMutexBuffer; ///< @brief Storage for `clockMutex`
+    SemaphoreHandle_t clockMutex = xSemaphoreCreateMutexStatic (&clockMutexBuffer); ///< @brief Serializes changes to clock correction and system time
+#endif
+    NTPTimeBase_t timeBase = {};    ///< @brief Time base used by `micros()`. Protected by `timeBaseSequence`
+    std::atomic<uint32_t> timeBaseSequence{0};  ///< @brief Seqlock counter. Odd while time base is being written, zero if never published
+#ifdef ESP32
+    portMUX_TYPE timeBaseMux = portMUX_INITIALIZER_UNLOCKED;   ///< @brief Serializes time base writers
+#endif
+    
+    TimeZone* timeZones[MAX_TIME_ZONES] = {};       ///< @brief Registered time zones. They are allocated when registered and read only after that
+    std::atomic<uint8_t> numTimeZones{0};           ///< @brief Number of registered time zones
+    
+    NTPLocalTimeCache_t localTimeCache = {};    ///< @brief Last local minute breakdown. Protected by `localTimeSequence`
+    std::atomic<uint32_t> localTimeSequence{0}; ///< @brief Seqlock counter. Odd while local time cache is being written
+    std::atomic<uint32_t> tzGeneration{1};      ///< @brief Changes on every `setTimeZone()` call to invalidate local time cache
+#ifdef ESP32
+    portMUX_TYPE localTimeMux = portMUX_INITIALIZER_UNLOCKED;  ///< @brief Serializes local time cache writers
+#endif
+    
+    /**
+      * @brief Increments a sync health counter. Safe to be called from any task
+      * @param metric Counter
+      * @param amount Value to add
+      */
+    void countMetric (NTPMetric_t metric, uint32_t amount = 1) {
+        metricCounters[metric].fetch_add (amount, std::memory_order_relaxed);
+    }
+
+    /**
+      * @brief Adds a value to a sync health histogram. Safe to be called from any task
+      * @param histogram Histogram
+      * @param value Value to add. Values over last bin lower limit are counted on last bin
+      */
+    void addHistogramSample (NTPHistogram_t histogram, uint64_t value) {
+        unsigned int bin = value ? 64 - __builtin_clzll (value) : 0;
+        if (bin >= METRICS_HISTOGRAM_BINS) {
+            bin = METRICS_HISTOGRAM_BINS - 1;
+        }
+        metricHistograms[histogram][bin].fetch_add (1, std::memory_order_relaxed);
+    }
+
+    /**
+      * @brief Adds time elapsed since last call to counter of current sync state. Called only from sync loop,
+      * so state time resolution is loop period
+      */
+    void accountStateTime ();
+
+    /**
+      * @brief Takes clock mutex. Clock correction is changed from sync loop, receiver task and user calls
+      */
+    void lockClock () {
+#ifdef ESP32
+        xSemaphoreTake (clockMutex, portMAX_DELAY);
+#endif
+    }
+
+    /**
+      * @brief Releases clock mutex
+      */
+    void unlockClock () {
+#ifdef ESP32
+        xSemaphoreGive (clockMutex);
+#endif
+    }
+
+    /**
+      * @brief Moves correction accumulated by slew and frequency compensation to system clock once it reaches
+      * `SYSTEM_CLOCK_TOLERANCE`, so that `time(NULL)` and `gettimeofday()` follow `NTP.micros()`. Time base is
+      * published again if system time was changed outside library. Called from sync loop
+      */
+    void syncSystemClock ();
+
+    /**
+      * @brief Publishes correction model as time base for `micros()`. Has to be called every time slew or frequency
+      * correction change, with clock mutex taken. Time at this moment is predicted from previous time base, so
+      * library time is continuous, unless there is no previous time base or system time has been stepped
+      * @param stepped `true` if time has to be taken from system time because it has been stepped
+      */
+    void publishTimeBase (bool stepped = false);
+    
+    /**
+      * @brief Calculates library time from a time base
+      * @param base Time base
+      * @param now Monotonic time as given by `monotonicMicros()`
+      * @return Microseconds since 1-Jan-1970 00:00 UTC
+      */
+    static int64_t timeBaseMicros (const NTPTimeBase_t* base, int64_t now) {
+        int64_t elapsed = now - base->monotonic;
+        int64_t microseconds = base->utc + elapsed + elapsed * base->frequency / 1000000000LL;
+        int64_t slewElapsed = (base->slewEnd < now ? base->slewEnd : now) - base->monotonic;
+        if (slewElapsed > 0) {
+            microseconds += slewElapsed * base->slewRate / 1000000000LL;
+        }
+        return microseconds;
+    }
+    
+    /**
+      * @brief Gets a consistent copy of time base. Never blocks, retries if a writer updated it meanwhile
+      * @param base Storage for time base
+      * @return `false` if time base has not been published yet
+      */
+    bool readTimeBase (NTPTimeBase_t* base) {
+        uint32_t sequence;
+        do {
+            sequence = timeBaseSequence.load (std::memory_order_acquire);
+            if (!sequence) {
+                return false;
+            }
+            *base = timeBase;
+            std::atomic_thread_fence (std::memory_order_acquire);
+        } while ((sequence & 1) || sequence != timeBaseSequence.load (std::memory_order_relaxed));
+        return true;
+    }
+    
+    /**
+      * @brief Gets correction that library adds to system time
+      * @param now Monotonic time as given by `monotonicMicros()`
+      * @return Correction in microseconds
+      */
+    int64_t getClockCorrection (int64_t now) {
+        int64_t correction = clockCorrection + (now - correctionRef) * clockFrequency / 1000000000LL;
+        int64_t slewElapsed = (slewEnd < now ? slewEnd : now) - correctionRef;
+        if (slewElapsed > 0) {
+            correction += slewElapsed * slewRate / 1000000000LL;
+        }
+        return correction;
+    }
+    
+    /**
+      * @brief Gets total correction applied by library on clock since start, stepped or slewed. Clock filter uses it
+      * to refer old samples to current clock
+      * @return Correction in microseconds
+      */
+    int64_t getTotalCorrection () {
+        lockClock ();
+        int64_t correction = movedCorrection + getClockCorrection (monotonicMicros ());
+        unlockClock ();
+        return correction;
+    }
+    
+    /**
+      * @brief Consolidates current correction so that frequency or slew may be changed from now on
+      * @param now Monotonic time as given by `monotonicMicros()`
+      */
+    void foldClockCorrection (int64_t now) {
+        clockCorrection = getClockCorrection (now);
+        correctionRef = now;
+    }
+    
+    /**
+      * @brief Updates local oscillator frequency estimation with a new offset, in the style of RFC5905 clock discipline.
+      * Frequency error is got from phase change since previous offset (FLL) and from offset itself (PLL)
+      * @param offsetUs Measured offset in microseconds
+      * @param applied `true` if offset is going to be corrected
+      */
+    void updateFrequency (int64_t offsetUs, bool applied);
+    
+    /**
+      * @brief Adapts sync interval to last offset, in the style of RFC5905 poll process. Interval is increased
+      * while offsets are well within `minSyncAccuracyUs` and decreased when they grow or frequency estimation changes
+      * @param offsetUs Last measured offset in microseconds
+      */
+    void updatePollInterval (int64_t offsetUs);
+    
+    /**
+      * @brief Gets sync interval to use when time is synchronized
+      * @return Interval in milliseconds. `longInterval` if adaptive sync interval is disabled
+      */
+    unsigned int getSyncdInterval () {
+        if (adaptivePoll) {
+            return (1UL << pollExponent) * 1000UL;
+        }
+        return longInterval;
+    }
+
+    /**
+      * @brief Gets current time as seen by library clock, this is system time plus slew correction
+      * @param tv Pointer to `timeval` to store current time
+      */
+    void getCorrectedTime (timeval* tv) {
+        int64_t now_us = micros ();
+        tv->tv_sec = now_us / 1000000L;
+        tv->tv_usec = now_us - (int64_t)tv->tv_sec * 1000000L;
+    }
     
     /**
       * @brief Gets time from NTP server and convert it to Unix time format
@@ -303,10 +909,27 @@ protected:
                               const ip_addr_t* addr, u16_t port);
     
     /**
-      * @brief Receiver task to check for received packets and launch packet processor
+      * @brief Receiver task to process received packets. It sleeps until `s_recvPacket` notifies
+      * a new response on ESP32 and it is called by `pollReceiver` on ESP8266
       * @param arg `NTPClient` instance
       */ 
     static void s_receiverTask (void* arg);
+
+#ifdef ESP8266
+    /**
+      * @brief Processes pending response timeout and runs receiver if there is any work pending for it. It is
+      * registered once as a recurrent scheduled function, so nothing is allocated per response or timeout
+      * @return Always true to keep it registered
+      */
+    bool pollReceiver ();
+#endif // ESP8266
+    
+    /**
+      * @brief Checks leap indicator, version, mode and stratum of a received packet
+      * @param ntpPacket Packet to analyze
+      * @return `true` if NTP packet is a valid server response
+      */
+    bool checkNTPpacket (NTPPacket_t* ntpPacket);
     
     /**
       * @brief Checks if received packet may be used to get a good sync
@@ -323,7 +946,8 @@ protected:
     void dumpNtpPacketInfo (NTPPacket_t* decPacket);
     
     /**
-      * @brief Static method to call NTP response timeout processor
+      * @brief Static method to call NTP response timeout processor. On ESP8266 it runs on timer context, so it
+      * only flags timeout to be processed from loop
       */
     static void s_processRequestTimeout (void* arg);
     
@@ -333,17 +957,139 @@ protected:
     void processRequestTimeout ();
     
     /**
-      * @brief Sends NTP request to server
+      * @brief Sends NTP request to server and adds it to outstanding request table
+      * @param destination Server address. If `NULL` request is sent to connected address
+      * @param server Index of server on server set
       * @return false in case of any error
       */
-    boolean sendNTPpacket ();
+    boolean sendNTPpacket (const ip_addr_t* destination = NULL, uint8_t server = 0);
+    
+    /**
+      * @brief Gets request buffer ready to be sent. Buffer is allocated and filled from request template only once
+      * and reused while network stack does not keep a reference to it, so sending does not use heap memory
+      * @return Request buffer. Only transmit timestamp has to be written on it
+      */
+    pbuf* getRequestBuffer ();
+    
+    /**
+      * @brief Reserves an entry on outstanding request table. A free or expired entry is used, or the oldest one if table is full.
+      * It may be matched only after it is set to `requestEntrySent`
+      * @param address Server address
+      * @param server Index of server on server set
+      * @return Table entry
+      */
+    NTPRequest_t* addRequest (IPAddress address, uint8_t server);
+    
+    /**
+      * @brief Looks for the request that a response answers and removes it from table. Updates rejection counters
+      * @param origin Origin timestamp of response
+      * @param address Source address of response
+      * @param port Source port of response
+      * @param sendTime Storage for local time when request was sent
+      * @return Index of server on server set or -1 if response has to be discarded
+      */
+    int matchRequest (NTPTimestamp_t origin, const ip_addr_t* address, uint16_t port, NTPTimestamp_t* sendTime);
+    
+    /**
+      * @brief Static method to send next burst request
+      */
+    static void s_sendBurstPacket (void* arg);
+    
+    /**
+      * @brief Sends next request of current burst and stops burst timer after the last one
+      */
+    void sendBurstPacket ();
+    
+    /**
+      * @brief Finishes current burst with samples got until now
+      */
+    void finishBurst ();
+    
+    /**
+      * @brief Gets name of a server in server set
+      * @param index Server index. Zero is main server
+      * @return Server name
+      */
+    const char* getServerName (unsigned int index) {
+        return index ? serverNames[index - 1] : ntpServerName;
+    }
+    
+    /**
+      * @brief Gets server address without blocking. Cached address is used until it expires. Then an asynchronous
+      * resolution is started and last known good address is used until it finishes
+      * @param index Server index. Zero is main server
+      * @return `true` if there is an address for this server
+      */
+    bool resolveServer (unsigned int index);
+    
+    /**
+      * @brief Stores result of a finished name resolution on server cache. Result is discarded if server
+      * name has changed meanwhile
+      * @param index Server index. Zero is main server
+      */
+    void collectDnsResult (unsigned int index);
+    
+    /**
+      * @brief Starts queued name resolutions. It has to run on network stack task, so it is called through
+      * `tcpip_callback` on ESP32
+      * @param arg NTPClient instance
+      */
+    static void s_startDnsQueries (void* arg);
+    
+    /**
+      * @brief Sets result of a name resolution. Called on network stack task
+      * @param index Server index. Zero is main server
+      * @param address Resolved address. `NULL` if resolution failed
+      */
+    void finishDnsQuery (unsigned int index, const ip_addr_t* address);
+    
+    /**
+      * @brief Static callback for asynchronous name resolution
+      * @param name Resolved name
+      * @param address Resolved address. `NULL` if resolution failed
+      * @param arg NTPClient instance
+      */
+    static void s_dnsFound (const char* name, const ip_addr_t* address, void* arg);
+    
+    /**
+      * @brief Resolves every server in server set and sends a request to each one
+      * @return `true` if at least one request was sent
+      */
+    bool queryServerSet ();
+    
+    /**
+      * @brief Gets a response from server set
+      * @param ntpPacket Decoded response
+      * @param index Index of server that sent response
+      * @param offsetNs Offset calculated from response, in nanoseconds
+      */
+    void processServerSetResponse (NTPPacket_t* ntpPacket, unsigned int index, int64_t offsetNs);
+    
+    /**
+      * @brief Selects truechimers from server set responses using intersection algorithm and combines their offsets
+      * @param combinedOffset Weighted average of survivor offsets, in nanoseconds
+      * @param best Index of survivor with lowest root distance
+      * @return Number of survivors. Zero if there is no majority agreement
+      */
+    unsigned int selectServers (int64_t* combinedOffset, unsigned int* best);
+    
+    /**
+      * @brief Finishes current server set sync with responses got until now
+      */
+    void finishServerSet ();
     
        
     /**
       * @brief Gets packet response and update time as of its data
-      * @param p UDP response packet
+      * @param response Received response with its arrival time
+      */
+    void processPacket (NTPResponse_t* response);
+    
+    /**
+      * @brief Applies filtered offset after all requests of a sync have been answered and notifies result
+      * @param ntpPacket Last response packet, used to check server quality
       */
-    void processPacket (struct pbuf* p);
+    void processOffset (NTPPacket_t* ntpPacket);
     
     /**
       * @brief Decodes NTP response contained in buffer
@@ -355,18 +1101,19 @@ protected:
     NTPPacket_t* decodeNtpMessage (uint8_t* messageBuffer, size_t len, NTPPacket_t* decPacket);
 
     /**
-      * @brief Calculates offset from NTP response packet
+      * @brief Calculates offset and round trip delay from NTP response packet using integer arithmetic
+      * on NTP timestamps. Delay is stored in `delay`
       * @param ntpPacket NTP response packet structure
-      * @return Time offset in `timeval` format
+      * @return Time offset in nanoseconds
       */
-    timeval calculateOffset (NTPPacket_t* ntpPacket);
+    int64_t calculateOffset (NTPPacket_t* ntpPacket);
     
     /**
       * @brief Applies offset to system clock
-      * @param offset Calculated offset
+      * @param offsetNs Calculated offset in nanoseconds
       * @return `true` if process finished without errors
       */
-    bool adjustOffset (timeval* offset);
+    bool adjustOffset (int64_t offsetNs);
 
 public:
     /**
@@ -374,6 +1121,9 @@ public:
       */
     ~NTPClient () {
         stop ();
+        for (unsigned int i = 0; i < MAX_TIME_ZONES; i++) {
+            delete timeZones[i];
+        }
     }
     
     /**
@@ -393,7 +1143,6 @@ public:
         }
 #else
         loopTimer.detach ();
-        receiverTimer.detach ();
 #endif // ESP8266
         responseTimer.detach ();
 #ifdef ESP8266
@@ -428,6 +1177,129 @@ public:
       */
     bool setNtpServerName (const char* serverName);
     
+    /**
+     * @brief Adds a server to server set. All servers are queried in parallel on every sync and falsetickers
+     * are rejected using intersection algorithm. Main server set with `setNtpServerName` is always included
+     * @param serverName Server name or IP address
+     * @return `false` if name is invalid, server set is full or a sync is in progress
+     */
+    bool addNtpServer (const char* serverName);
+    
+    /**
+     * @brief Sets time that a resolved server address is used before resolving it again. If DNS fails
+     * last known good address keeps being used
+     * @param lifetime Cache lifetime in seconds
+     */
+    void setDnsCacheLifetime (int lifetime) {
+        if (lifetime >= 0) {
+            dnsCacheLifetime = lifetime * 1000000LL;
+        }
+    }
+    
+    /**
+     * @brief Forces server addresses to be resolved again on next sync
+     */
+    void flushDnsCache () {
+        for (unsigned int i = 0; i < MAX_NTP_SERVERS; i++) {
+            servers[i].addressExpiry = 0;
+        }
+    }
+    
+    /**
+     * @brief Enables or disables randomization of transmit timestamp bits under clock resolution. This makes
+     * it harder to forge a response to a request. Enabled by default
+     * @param randomize `true` to randomize transmit timestamp
+     */
+    void setRandomizeTransmit (bool randomize) {
+        randomizeTransmit = randomize;
+    }
+    
+    /**
+     * @brief Gets counters of responses discarded because they do not match an outstanding request
+     * @return Rejection counters
+     */
+    NTPRejectedResponses_t getRejectedResponses () {
+        NTPRejectedResponses_t rejected;
+        rejected.malformed = metricCounters[metricRejectedMalformed].load (std::memory_order_relaxed);
+        rejected.unknownOrigin = metricCounters[metricRejectedUnknownOrigin].load (std::memory_order_relaxed);
+        rejected.badSource = metricCounters[metricRejectedBadSource].load (std::memory_order_relaxed);
+        rejected.late = metricCounters[metricRejectedLate].load (std::memory_order_relaxed);
+        return rejected;
+    }
+
+    /**
+     * @brief Gets a snapshot of sync health metrics: counters of requests, responses, rejections by reason
+     * and time on every sync state, and log2 histograms of round trip delay, offset and DNS latency.
+     * Every value is read atomically, although snapshot may mix values from before and after a concurrent update
+     * @param metrics Storage for metrics
+     */
+    void getMetrics (NTPMetrics_t* metrics);
+
+    /**
+     * @brief Sets every metric to zero
+     */
+    void resetMetrics ();
+
+    /**
+     * @brief Gets a metric name, useful to export metrics
+     * @param metric Counter
+     * @return Name in snake case, like `requests_sent`
+     */
+    static const char* metricName (NTPMetric_t metric);
+
+    /**
+     * @brief Gets a histogram name, useful to export metrics
+     * @param histogram Histogram
+     * @return Name in snake case including unit, like `rtt_us`
+     */
+    static const char* histogramName (NTPHistogram_t histogram);
+    
+    /**
+     * @brief Gets time from poll start until request was sent on last sync, including name resolution
+     * @return Latency in microseconds
+     */
+    int64_t getRequestLatencyUs () {
+        return latency.request;
+    }
+    
+    /**
+     * @brief Gets time spent on every stage of last request and response. Useful to find where
+     * delay asymmetry comes from before tightening minimum sync accuracy
+     * @return Stage latencies in microseconds
+     */
+    NTPLatency_t getLatency () {
+        return latency;
+    }
+    
+    /**
+     * @brief Sets if transmit time (T1) is taken after `udp_send` returns instead of before calling it.
+     * Time spent on network stack then does not count as network delay. Enabled by default
+     * @param enable `true` to correct T1 with `udp_send` duration
+     */
+    void setPostSendTimestamp (bool enable) {
+        postSendTimestamp = enable;
+    }
+    
+    /**
+     * @brief Removes additional servers. Only main server is used after this
+     * @return `false` if a sync is in progress, as responses are matched to servers. Servers are not changed then
+     */
+    bool clearNtpServers () {
+        if (ntpRequested) {
+            return false;
+        }
+        numServers = 1;
+        return true;
+    }
+    
+    /**
+     * @brief Gets number of servers in server set, including main one
+     * @return Number of servers
+     */
+    uint8_t getNumNtpServers () {
+        return numServers;
+    }
+    
     /**
      * @brief Gets NTP server name
      * @return NTP server name
@@ -446,6 +1318,45 @@ public:
         }
     }
     
+    /**
+      * @brief Enables event queue. Events are queued instead of calling handler from sync process, so slow
+      * handlers do not delay sync. Queued events are got with `getNextEvent()` or `getEvents()`, or passed to
+      * handler by calling `handleEvents()` from `loop()`. Error events are kept on their own queue and delivered first.
+      * It should be called before `begin()`
+      * @param enable `true` to queue events, `false` to call handler at once
+      */
+    void setEventQueue (bool enable);
+    
+    /**
+      * @brief Gets next queued event. Error events come first. It has to be called always from the same task
+      * @param event Storage for event
+      * @return `false` if there are no queued events
+      */
+    bool getNextEvent (NTPEvent_t* event);
+    
+    /**
+      * @brief Gets several queued events at once. Error events come first. It has to be called always from the same task
+      * @param events Storage for events
+      * @param maxEvents Size of `events`
+      * @return Number of events got
+      */
+    size_t getEvents (NTPEvent_t* events, size_t maxEvents);
+    
+    /**
+      * @brief Passes queued events to handler set with `onNTPSyncEvent()`. To be called from `loop()` when event queue is enabled
+      * @param maxEvents Maximum number of events to handle. 0 means every queued event
+      * @return Number of events handled
+      */
+    unsigned int handleEvents (unsigned int maxEvents = 0);
+    
+    /**
+      * @brief Gets number of events dropped because they were not got from event queue fast enough
+      * @return Number of dropped events, including error ones
+      */
+    uint32_t getDroppedEvents () {
+        return eventQueue.dropped.load (std::memory_order_relaxed) + errorEventQueue.dropped.load (std::memory_order_relaxed);
+    }
+    
     /**
       * @brief Changes sync period
       * @param interval New interval in seconds
@@ -513,6 +1424,82 @@ public:
         }
     }
     
+    /**
+      * @brief Enables or disables slew mode. In slew mode offsets under `panicThreshold` are not applied as
+      * a step on system clock but amortized linearly on library time (`NTP.micros()`, `NTP.millis()`) during `window`.
+      * System clock follows library time in steps of `SYSTEM_CLOCK_TOLERANCE` microseconds
+      * @param enable `true` to apply offsets gradually
+      * @param window Time to amortize a correction, in seconds
+      * @param panicThreshold Offsets over this value, in microseconds, are always applied as a step
+      */
+    void setSlewMode (bool enable, int window = DEFAULT_SLEW_WINDOW, long panicThreshold = DEFAULT_SLEW_PANIC_THRESHOLD) {
+        slewEnabled = enable;
+        slewWindow = (window > 0 ? window : 1) * 1000000LL;
+        slewPanicThreshold = panicThreshold;
+    }
+
+    /**
+      * @brief Gets correction that is still pending to be applied by current slew
+      * @return Remaining correction in microseconds. 0 if there is no slew in progress
+      */
+    int64_t getSlewRemainingUs () {
+        int64_t remaining = 0;
+        lockClock (); // Slew end and rate are written together by sync loop
+        int64_t now = monotonicMicros ();
+        if (now < slewEnd) {
+            remaining = (slewEnd - now) * slewRate / 1000000000LL;
+        }
+        unlockClock ();
+        return remaining;
+    }
+
+    /**
+      * @brief Enables or disables local oscillator frequency compensation. When enabled, drift between syncs is
+      * estimated from successive offsets and corrected continuously on library time (`NTP.micros()`, `NTP.millis()`).
+      * This keeps error low during long sync intervals
+      * @param enable `true` to enable frequency discipline
+      */
+    void setFrequencyDiscipline (bool enable) {
+        if (!enable) {
+            lockClock ();
+            foldClockCorrection (monotonicMicros ());
+            clockFrequency = 0;
+            frequencyWander = 0;
+            lastFrequencySample = 0;
+            publishTimeBase ();
+            unlockClock ();
+        }
+        frequencyDiscipline = enable;
+    }
+
+    /**
+      * @brief Gets frequency correction applied to local clock. Positive value means that local oscillator is slow
+      * @return Frequency correction in ppm
+      */
+    double getFrequencyPpm () {
+        return clockFrequency / 1000.0;
+    }
+
+    /**
+      * @brief Gets confidence of frequency estimation, as RMS of recent frequency correction changes.
+      * Lower is better
+      * @return Frequency wander in ppm
+      */
+    double getFrequencyWanderPpm () {
+        return frequencyWander / 1000.0;
+    }
+
+    /**
+      * @brief Enables or disables adaptive sync interval. When enabled, interval in synchronized status is
+      * adapted between given limits to the lowest request rate that keeps offsets under minimum accuracy.
+      * Interval configured with `setInterval()` is not used meanwhile
+      * @param enable `true` to adapt sync interval
+      * @param minInterval Minimum sync interval in seconds. It is rounded up to a power of 2
+      * @param maxInterval Maximum sync interval in seconds. It is rounded down to a power of 2, but never under `minInterval`
+      * @return `false` if limits are not valid
+      */
+    bool setAdaptiveInterval (bool enable, int minInterval = 1 << DEFAULT_MIN_POLL_EXPONENT, int maxInterval = 1 << DEFAULT_MAX_POLL_EXPONENT);
+
     /**
       * @brief Sets max number of sync retrials if minimum accuracy has not been reached
       * @param maxRetry Max sync retrials number
@@ -535,15 +1522,144 @@ public:
         strncpy (tzname, TZ, TZNAME_LENGTH);
         setenv ("TZ", tzname, 1);
         tzset ();
+        tzGeneration.fetch_add (1, std::memory_order_release);
+    }
+
+    /**
+      * @brief Converts a time to local time breakdown, as `localtime_r`. Breakdown of last used minute is cached
+      * so that `localtime` is only called once a minute or when time zone is changed. Safe to be called from several tasks.
+      * If time zone is changed by calling `setenv` and `tzset` directly instead of `setTimeZone()`, it may take a
+      * minute to be applied
+      * @param moment `time_t` value (UNIX time) to convert
+      * @param result Storage for local time breakdown
+      * @return `result`
+      */
+    tm* localTime (time_t moment, tm* result);
+
+    /**
+      * @brief Sets time zone for getting local time by its IANA name, looking it up on flash time zone database.
+      * Useful when zone is only known at runtime
+      * @param name IANA zone name, like `Europe/Madrid`. It is case sensitive
+      * @return `false` if zone is not found. Time zone is not changed in that case
+      */
+    bool setTimeZoneByName (const char* name);
+
+    /**
+      * @brief Registers a time zone, so that time may be converted to it without changing system time zone.
+      * Zones should be registered at setup, before other tasks use them
+      * @param tz POSIX TZ string, like `TZ_Europe_Madrid`
+      * @return Time zone id to be used on conversions. -1 if string is not valid or there are already `MAX_TIME_ZONES` zones
+      */
+    int addTimeZone (const char* tz);
+
+    /**
+      * @brief Registers a time zone by its IANA name, looking it up on flash time zone database
+      * @param name IANA zone name, like `Europe/Madrid`
+      * @return Time zone id to be used on conversions. -1 if zone is not found or there are already `MAX_TIME_ZONES` zones
+      */
+    int addTimeZoneByName (const char* name) {
+        return addTimeZone (findTimeZone (name));
+    }
+
+    /**
+      * @brief Gets number of registered time zones
+      * @return Number of time zones
+      */
+    uint8_t getNumTimeZones () {
+        return numTimeZones.load (std::memory_order_acquire);
+    }
+
+    /**
+      * @brief Gets a registered time zone
+      * @param zone Time zone id, as returned by `addTimeZone()`
+      * @return Time zone object. `NULL` if id is not valid
+      */
+    const TimeZone* getTimeZone (int zone) {
+        if (zone < 0 || zone >= getNumTimeZones ()) {
+            return NULL;
+        }
+        return timeZones[zone];
+    }
+
+    /**
+      * @brief Converts a time to local time breakdown on a registered time zone. Does not use nor change
+      * system time zone, so it is safe to be called from several tasks
+      * @param zone Time zone id, as returned by `addTimeZone()`
+      * @param moment `time_t` value (UNIX time) to convert
+      * @param result Storage for local time breakdown
+      * @return `result`. `NULL` if time zone id is not valid
+      */
+    tm* localTime (int zone, time_t moment, tm* result) {
+        const TimeZone* timeZone = getTimeZone (zone);
+        return timeZone ? timeZone->localTime (moment, result) : NULL;
     }
     
     /**
-      * @brief Converts current time to a char string
+      * @brief Converts a time to a `HH:MM:SS.uuuuuu` char string on a caller buffer. Safe to be called from several tasks
+      * @param buffer Destination buffer. `TIME_STR_LENGTH` bytes are enough
+      * @param size Buffer size
+      * @param moment `timeval` object to convert
+      * @return `buffer`
+      */
+    char* getTimeStr (char* buffer, size_t size, timeval moment);
+
+    /**
+      * @brief Converts a time to a `HH:MM:SS` char string on a caller buffer. Safe to be called from several tasks
+      * @param buffer Destination buffer. `TIME_STR_LENGTH` bytes are enough
+      * @param size Buffer size
+      * @param moment `time_t` value (UNIX time) to convert
+      * @return `buffer`
+      */
+    char* getTimeStr (char* buffer, size_t size, time_t moment);
+
+    /**
+      * @brief Converts a time to a `dd/mm/yyyy` char string on a caller buffer. Safe to be called from several tasks
+      * @param buffer Destination buffer. `DATE_STR_LENGTH` bytes are enough
+      * @param size Buffer size
+      * @param moment `time_t` value (UNIX time) to convert
+      * @return `buffer`
+      */
+    char* getDateStr (char* buffer, size_t size, time_t moment);
+
+    /**
+      * @brief Converts a time to a char string on a caller buffer, adding microseconds and time zone. Safe to be called from several tasks
+      * @param buffer Destination buffer. `TIME_DATE_STR_LENGTH` bytes are enough for default format
+      * @param size Buffer size
+      * @param moment `timeval` object to convert
+      * @param format Format as `strftime`. If `NULL`, a faster built in `dd/mm/yyyy HH:MM:SS` format is used
+      * @return `buffer`
+      */
+    char* getTimeDateString (char* buffer, size_t size, timeval moment, const char* format = NULL);
+
+    /**
+      * @brief Converts a time to a char string on a caller buffer. Safe to be called from several tasks
+      * @param buffer Destination buffer. `TIME_DATE_STR_LENGTH` bytes are enough for default format
+      * @param size Buffer size
+      * @param moment `time_t` value (UNIX time) to convert
+      * @param format Format as `strftime`. If `NULL`, a faster built in `dd/mm/yyyy HH:MM:SS` format is used
+      * @return `buffer`
+      */
+    char* getTimeDateString (char* buffer, size_t size, time_t moment, const char* format = NULL);
+
+    /**
+      * @brief Converts a time to a char string on a registered time zone, adding microseconds and zone abbreviation.
+      * Does not use nor change system time zone, so it is safe to be called from several tasks
+      * @param zone Time zone id, as returned by `addTimeZone()`
+      * @param buffer Destination buffer. `TIME_DATE_STR_LENGTH` bytes are enough for default format
+      * @param size Buffer size
+      * @param moment `timeval` object to convert
+      * @param format Format as `strftime`, without `%Z`. If `NULL`, a faster built in `dd/mm/yyyy HH:MM:SS` format is used
+      * @return `buffer`. It is empty if time zone id is not valid
+      */
+    char* getTimeDateString (int zone, char* buffer, size_t size, timeval moment, const char* format = NULL);
+
+    /**
+      * @brief Converts current time to a char string. Result is stored on a shared buffer,
+      * use `getTimeStr(buffer, size, moment)` if it is called from several tasks
       * @return String built from current time
       */
     char* getTimeStr () {
-        time_t currentTime = time (NULL);
-        return getTimeStr (currentTime);
+        return getTimeStr (strBuffer, sizeof (strBuffer), time (NULL));
     }
 
     /**
@@ -552,10 +1668,7 @@ public:
       * @return String built from given time
       */
     char* getTimeStr (timeval moment) {
-        tm* local_tm = localtime (&moment.tv_sec);
-        size_t index = strftime (strBuffer, sizeof (strBuffer), "%H:%M:%S", local_tm);
-        snprintf (strBuffer + index, sizeof (strBuffer) - index, ".%06ld", moment.tv_usec);
-        return strBuffer;
+        return getTimeStr (strBuffer, sizeof (strBuffer), moment);
     }
     
     /**
@@ -564,9 +1677,7 @@ public:
       * @return String built from given time
       */
     char* getTimeStr (time_t moment) {
-        tm* local_tm = localtime (&moment);
-        strftime (strBuffer, sizeof(strBuffer), "%H:%M:%S", local_tm);
-        return strBuffer;
+        return getTimeStr (strBuffer, sizeof (strBuffer), moment);
     }
 
     /**
@@ -574,8 +1685,7 @@ public:
     * @return String built from current date
     */
     char* getDateStr () {
-        time_t currentTime = time (NULL);
-        return getDateStr (currentTime);
+        return getDateStr (strBuffer, sizeof (strBuffer), time (NULL));
     }
 
     /**
@@ -584,7 +1694,7 @@ public:
     * @return String built from given time
     */
     char* getDateStr (timeval moment) {
-        return getDateStr (moment.tv_sec);
+        return getDateStr (strBuffer, sizeof (strBuffer), moment.tv_sec);
     }
     
     /**
@@ -593,9 +1703,7 @@ public:
     * @return String built from given time
     */
     char* getDateStr (time_t moment) {
-        tm* local_tm = localtime (&moment);
-        strftime (strBuffer, sizeof (strBuffer), "%02d/%m/%04Y", local_tm);
-        return strBuffer;
+        return getDateStr (strBuffer, sizeof (strBuffer), moment);
     }
     
     /**
@@ -603,8 +1711,19 @@ public:
     * @param[out] Char string built from current time.
     */
     char* getTimeDateString () {
-        time_t currentTime = time (NULL);
-        return getTimeDateString (currentTime);
+        return getTimeDateString (strBuffer, sizeof (strBuffer), time (NULL));
+    }
+
+    /**
+    * @brief Converts current time and date to a char string on a caller buffer, with microseconds. Safe to be called from several tasks
+    * @param buffer Destination buffer. `TIME_DATE_STR_LENGTH` bytes are enough
+    * @param size Buffer size
+    * @return `buffer`
+    */
+    char* getTimeDateStringUs (char* buffer, size_t size) {
+        timeval currentTime;
+        getCorrectedTime (&currentTime);
+        return getTimeDateString (buffer, size, currentTime);
     }
 
     /**
@@ -613,8 +1732,8 @@ public:
     */
     char* getTimeDateStringUs () {
         timeval currentTime;
-        gettimeofday (&currentTime, NULL);
-        return getTimeDateString (currentTime);
+        getCorrectedTime (&currentTime);
+        return getTimeDateString (strBuffer, sizeof (strBuffer), currentTime);
     }
     
     /**
@@ -622,34 +1741,27 @@ public:
     * @return Char string built from current time
     */
     char* getTimeDateStringForJS () {
-        return getTimeDateString (time (NULL), "%02m/%02d/%04Y %02H:%02M:%02S");
+        return getTimeDateString (strBuffer, sizeof (strBuffer), time (NULL), "%02m/%02d/%04Y %02H:%02M:%02S");
     }
     
     /**
     * @brief Converts given time and date to a char string
     * @param moment `timeval` object to convert to String
-    * @param format Format as printf
+    * @param format Format as `strftime`. If `NULL`, `dd/mm/yyyy HH:MM:SS` is used
     * @return Char string built from current time
     */
-    char* getTimeDateString (timeval moment, const char* format = "%02d/%02m/%04Y %02H:%02M:%02S") {
-        tm* local_tm = localtime (&moment.tv_sec);
-        size_t index = strftime (strBuffer, sizeof (strBuffer), format, local_tm);
-        index += snprintf (strBuffer + index, sizeof (strBuffer) - index, ".%06ld", moment.tv_usec);
-        strftime (strBuffer + index, sizeof (strBuffer) - index, " %Z", local_tm);
-        return strBuffer;
+    char* getTimeDateString (timeval moment, const char* format = NULL) {
+        return getTimeDateString (strBuffer, sizeof (strBuffer), moment, format);
     }
 
     /**
     * @brief Converts given time and date to a char string
     * @param moment `time_t` value (UNIX time) to convert to char string
-    * @param format Format as printf
+    * @param format Format as `strftime`. If `NULL`, `dd/mm/yyyy HH:MM:SS` is used
     * @return Char string built from current time
     */
-    char* getTimeDateString (time_t moment, const char* format = "%02d/%02m/%04Y %02H:%02M:%02S") {
-        tm* local_tm = localtime (&moment);
-        strftime (strBuffer, sizeof (strBuffer), format, local_tm);
-
-        return strBuffer;
+    char* getTimeDateString (time_t moment, const char* format = NULL) {
+        return getTimeDateString (strBuffer, sizeof (strBuffer), moment, format);
     }
     
     /**
@@ -673,7 +1785,17 @@ public:
     * @brief Gets uptime in human readable String format
     * @return Uptime
     */
-    char* getUptimeString ();
+    char* getUptimeString () {
+        return getUptimeString (strBuffer, sizeof (strBuffer));
+    }
+
+    /**
+    * @brief Gets uptime in human readable String format on a caller buffer. Safe to be called from several tasks
+    * @param buffer Destination buffer. `UPTIME_STR_LENGTH` bytes are enough
+    * @param size Buffer size
+    * @return `buffer`
+    */
+    char* getUptimeString (char* buffer, size_t size);
 
     /**
     * @brief Gets uptime in UNIX format, time since MCU was last rebooted
@@ -709,27 +1831,35 @@ public:
     }
 
     /**
-     * @brief Gets milliseconds since 1-Jan-1970 00:00 UTC
+     * @brief Gets milliseconds since 1-Jan-1970 00:00 UTC, including slew correction
      * @return Milliseconds since 1-Jan-1970 00:00 UTC
      */
     int64_t millis () {
-        timeval currentTime;
-        gettimeofday (&currentTime, NULL);
-        int64_t milliseconds = (int64_t)currentTime.tv_sec * 1000L + (int64_t)currentTime.tv_usec / 1000L;
-        //Serial.printf ("timeval: %ld.%ld millis %lld\n", currentTime.tv_sec, currentTime.tv_usec, milliseconds);
-        return milliseconds;
+        return micros () / 1000L;
     }
     
     /**
-     * @brief Gets microseconds since 1-Jan-1970 00:00 UTC
+     * @brief Gets microseconds since 1-Jan-1970 00:00 UTC, including slew correction. Time is calculated from
+     * monotonic counter and a time base published on every sync, so it takes no locks nor system calls
      * @return microseconds since 1-Jan-1970 00:00 UTC
      */
     int64_t micros() {
-        timeval currentTime;
-        gettimeofday (&currentTime, NULL);
-        int64_t microseconds = (int64_t)currentTime.tv_sec * 1000000L + (int64_t)currentTime.tv_usec;
-        //Serial.printf ("timeval: %ld.%ld micros %lld\n", currentTime.tv_sec, currentTime.tv_usec, microseconds);
-        return microseconds;
+        NTPTimeBase_t base;
+        if (!readTimeBase (&base)) { // Not published yet
+            timeval currentTime;
+            gettimeofday (&currentTime, NULL);
+            int64_t microseconds = (int64_t)currentTime.tv_sec * 1000000L + (int64_t)currentTime.tv_usec;
+            return microseconds + getClockCorrection (monotonicMicros ());
+        }
+        return timeBaseMicros (&base, monotonicMicros ());
+    }
+
+    /**
+     * @brief Gets number of responses that were dropped because they arrived faster than they could be processed
+     * @return Number of dropped responses
+     */
+    uint32_t getResponseQueueOverflows () {
+        return responseQueueOverflows;
     }
 
     /**
@@ -739,6 +1869,15 @@ public:
      */
     char* ntpEvent2str (NTPEvent_t e);
 
+    /**
+     * @brief Gets text description from event on a caller buffer. Safe to be called from several tasks
+     * @param e NTP event
+     * @param buffer Destination buffer. `EVENT_STR_LENGTH` bytes are enough
+     * @param size Buffer size
+     * @return `buffer`
+     */
+    char* ntpEvent2str (NTPEvent_t e, char* buffer, size_t size);
+
     /**
      * @brief Sets the number of sync attempts to calculate average offset
      * @param rounds Number of average rounds 1.. MAX_OFFSET_AVERAGE_ROUNDS
@@ -753,6 +1892,33 @@ public:
         }
     }
 
+    /**
+     * @brief Enables or disables burst mode. Every sync sends a burst of requests spaced `spacing` milliseconds
+     * and uses the best response. Sync finishes when all responses arrive or on timeout. Average rounds are not used
+     * in this mode
+     * @param enable `true` to send bursts
+     * @param size Number of requests in every burst, 1.. MAX_BURST_SIZE
+     * @param spacing Time between requests in milliseconds
+     * @return `true` if parameters are valid
+     */
+    bool setBurstMode (bool enable, int size = DEFAULT_BURST_SIZE, int spacing = DEFAULT_BURST_SPACING);
+
+    /**
+     * @brief Sets the method to get offset from samples. Default is RFC5905 minimum delay clock filter
+     * @param filter `minDelayFilter` or `averageFilter`
+     */
+    void setOffsetFilter (NTPOffsetFilter_t filter) {
+        offsetFilter = filter;
+    }
+
+    /**
+     * @brief Gets jitter of last synchronization, as RMS of differences between selected offset and other samples
+     * @return Jitter in microseconds
+     */
+    int64_t getJitterUs () {
+        return jitter / 1000;
+    }
+
     /**
      * @brief Gets the number of sync attempts to calculate average offset
      * @return Number of average rounds 1.. MAX_OFFSET_AVERAGE_ROUNDS
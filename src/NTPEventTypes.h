@@ -31,9 +31,14 @@ typedef struct {
     double offset = 0.0; /**< Last offset applied */
     double delay = 0.0; /**< Last calculates round trip delay to NTP server */
     float dispersion = 0.0;
+    double jitter = 0.0; /**< RMS of differences between selected offset and other recent samples, in seconds */
     IPAddress serverAddress; /**< NTP server IP address */
     unsigned int port = 0; /**< NTP port used */
     unsigned int retrials = 0; /**< Number of resync retrials until time was got with required accuracy */
+    bool slewing = false; /**< True if offset is being applied gradually in slew mode */
+    double slewRemaining = 0.0; /**< Correction pending to be applied by slew in progress, in seconds */
+    double frequency = 0.0; /**< Estimated frequency correction of local clock, in ppm */
+    double frequencyWander = 0.0; /**< Confidence of frequency estimation as RMS of its recent changes, in ppm. Lower is better */
 } NTPSyncEventInfo_t;
 
 /**
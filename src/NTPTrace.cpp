@@ -0,0 +1,54 @@
+#include "NTPTrace.h"
+
+#ifdef NTP_TRACE
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+#include <atomic>
+#ifdef ESP32
+#include <esp_timer.h>
+#endif
+
+static_assert ((NTP_TRACE_SIZE & (NTP_TRACE_SIZE - 1)) == 0, "NTP_TRACE_SIZE must be a power of 2");
+
+static NTPTraceRecord_t traceRing[NTP_TRACE_SIZE];
+static std::atomic<uint32_t> traceHead{0};
+
+void ntpTrace (NTPTraceEvent_t event, int32_t arg0, int32_t arg1) {
+    // Slot is claimed atomically, so concurrent writers never share a record. Oldest ones are overwritten.
+    // Time is read after that, so record order follows time unless writer is preempted in between
+    uint32_t index = traceHead.fetch_add (1, std::memory_order_relaxed);
+    NTPTraceRecord_t* record = &(traceRing[index & (NTP_TRACE_SIZE - 1)]);
+
+    // Cycle counter is per core on ESP32 so a clock shared by all cores is used
+#ifdef ESP32
+    record->micros = (uint32_t)esp_timer_get_time ();
+#else
+    record->micros = (uint32_t)micros64 ();
+#endif
+    record->event = event;
+    record->sequence = (uint16_t)index;
+    record->arg0 = arg0;
+    record->arg1 = arg1;
+}
+
+void ntpTraceDump (Print& output) {
+    uint32_t head = traceHead.load (std::memory_order_acquire);
+    uint32_t first = head > NTP_TRACE_SIZE ? head - NTP_TRACE_SIZE : 0;
+
+    output.printf ("NTPTRACE US %u\n", (unsigned int)(head - first));
+    for (uint32_t i = first; i < head; i++) {
+        const NTPTraceRecord_t* record = &(traceRing[i & (NTP_TRACE_SIZE - 1)]);
+        output.printf ("NTPT %04X %08X %02X %d %d\n", record->sequence, (unsigned int)record->micros, record->event,
+                       (int)record->arg0, (int)record->arg1);
+    }
+    output.printf ("NTPTRACE END\n");
+}
+
+void ntpTraceClear () {
+    traceHead.store (0, std::memory_order_release);
+}
+
+#endif // NTP_TRACE
@@ -0,0 +1,80 @@
+/**
+  * @file NTPTrace.h
+  * @version 0.2.6
+  * @date 29/12/2021
+  * @author German Martin
+  * @brief Binary trace points for sync process. They are compiled only if `NTP_TRACE` is defined, so they
+  * cost nothing otherwise. Records are stored on a RAM ring and decoded by `tools/NTPTraceDecode.py`
+  */
+
+#ifndef _NTPTrace_h
+#define _NTPTrace_h
+
+#include <stdint.h>
+
+//#define NTP_TRACE
+
+#ifndef NTP_TRACE_SIZE
+#define NTP_TRACE_SIZE 256 ///< @brief Number of records on trace ring. Must be a power of 2
+#endif
+
+  /**
+    * @brief Trace points. Values are kept stable as decoder relies on them
+    */
+typedef enum {
+    tracePollStart = 1,             ///< @brief Sync started. Args: number of servers, burst size
+    traceDnsStart = 2,              ///< @brief Server name resolution started. Args: server index
+    traceDnsDone = 3,               ///< @brief Server name resolution finished. Args: server index, 1 if resolved
+    traceSendStart = 4,             ///< @brief Request built, about to be sent. Args: server index
+    traceSendDone = 5,              ///< @brief Request sent. Args: server index, lwIP error code
+    traceReceive = 6,               ///< @brief Response arrived on lwIP callback. Args: length, source port
+    traceProcessStart = 7,          ///< @brief Receiver started processing response. Args: length
+    traceDecoded = 8,               ///< @brief Response decoded. Args: 1 if valid
+    traceMatched = 9,               ///< @brief Response matched to a request. Args: server index, -1 if not matched
+    traceOffset = 10,               ///< @brief Offset calculated. Args: offset and delay in microseconds
+    traceAdjustStart = 11,          ///< @brief Clock adjustment started. Args: offset in microseconds
+    traceAdjustDone = 12,           ///< @brief Clock adjustment finished. Args: 1 if slewing, 1 if successful
+    traceTimeout = 13,              ///< @brief Sync timed out. Args: responses got
+    traceSyncDone = 14              ///< @brief Sync finished. Args: status
+} NTPTraceEvent_t;
+
+  /**
+    * @brief Trace record
+    */
+typedef struct {
+    uint32_t micros;                ///< @brief Low bits of monotonic time when record was taken, in microseconds. Shared by all cores
+    uint16_t event;                 ///< @brief Trace point, as `NTPTraceEvent_t`
+    uint16_t sequence;              ///< @brief Low bits of record number, to find where ring starts
+    int32_t arg0;                   ///< @brief First argument
+    int32_t arg1;                   ///< @brief Second argument
+} NTPTraceRecord_t;
+
+#ifdef NTP_TRACE
+class Print;
+
+  /**
+    * @brief Stores a trace record. Lock free, so it may be called from any task
+    * @param event Trace point
+    * @param arg0 First argument
+    * @param arg1 Second argument
+    */
+void ntpTrace (NTPTraceEvent_t event, int32_t arg0, int32_t arg1);
+
+  /**
+    * @brief Writes trace ring as text lines to be decoded by `tools/NTPTraceDecode.py`. Records written
+    * while dump is running may appear mixed
+    * @param output Destination, like `Serial`
+    */
+void ntpTraceDump (Print& output);
+
+  /**
+    * @brief Empties trace ring
+    */
+void ntpTraceClear ();
+
+#define NTP_TRACE_POINT(event, arg0, arg1) ntpTrace (event, (int32_t)(arg0), (int32_t)(arg1))
+#else
+#define NTP_TRACE_POINT(event, arg0, arg1) do {} while (0)
+#endif // NTP_TRACE
+
+#endif // _NTPTrace_h
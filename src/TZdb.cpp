@@ -0,0 +1,28 @@
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+#include "TZdb.h"
+#include "TZdbData.h" // Generated by tools/TZdbGenerate.py
+
+const char* findTimeZone (const char* name) {
+    int low = 0;
+    int high = TZDB_NUM_ZONES - 1;
+
+    if (!name) {
+        return NULL;
+    }
+    while (low <= high) {
+        int middle = (low + high) / 2;
+        int result = strcmp_P (name, tzdbNames + pgm_read_word (&(tzdbZones[middle].name)));
+        if (!result) {
+            return tzdbRules + pgm_read_word (&(tzdbZones[middle].rule));
+        } else if (result < 0) {
+            high = middle - 1;
+        } else {
+            low = middle + 1;
+        }
+    }
+    return NULL;
+}
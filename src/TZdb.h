@@ -0,0 +1,29 @@
+/**
+  * @file TZdb.h
+  * @version 0.2.6
+  * @date 29/12/2021
+  * @author German Martin
+  * @brief Time zone database stored in flash, to get POSIX TZ strings from IANA zone names at runtime
+  */
+
+#ifndef _TZdb_h
+#define _TZdb_h
+
+#include <stdint.h>
+
+  /**
+    * @brief Time zone database entry. Offsets point to zero terminated strings on flash pools
+    */
+typedef struct {
+    uint16_t name;                  ///< @brief Offset of IANA zone name on `tzdbNames`
+    uint16_t rule;                  ///< @brief Offset of POSIX TZ string on `tzdbRules`. Shared by zones with the same rules
+} TZdbEntry_t;
+
+  /**
+    * @brief Finds POSIX TZ string of a zone by its IANA name, using a binary search on a sorted table
+    * @param name IANA zone name, like `Europe/Madrid`. It is case sensitive
+    * @return POSIX TZ string, stored in flash as `TZ_*` values. `NULL` if zone is not found
+    */
+const char* findTimeZone (const char* name);
+
+#endif // _TZdb_h
@@ -0,0 +1,372 @@
+#include "TimeZone.h"
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+#include <ctype.h>
+#include <string.h>
+
+constexpr auto SECONDS_PER_DAY = 86400L;
+constexpr auto SECONDS_PER_HOUR = 3600L;
+constexpr auto MAX_RULE_TIME = 167 * SECONDS_PER_HOUR; // RFC 8536 extension to POSIX
+constexpr int64_t MAX_TIME_T = sizeof (time_t) < sizeof (int64_t) ? INT32_MAX : INT64_MAX; // 32 bit time_t ends on 19-Jan-2038
+
+  /**
+    * @brief Integer division rounding towards negative infinity
+    */
+static inline int64_t floorDiv (int64_t a, int64_t b) {
+    return (a >= 0 ? a : a - b + 1) / b;
+}
+
+static inline bool isLeapYear (int year) {
+    return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+}
+
+  /**
+    * @brief Days from 1-Jan-1970 to a civil date. Valid for any proleptic gregorian date
+    * @param year Year
+    * @param month Month, 1-12
+    * @param day Day of month, 1-31
+    * @return Days since 1-Jan-1970
+    */
+static int64_t daysFromCivil (int year, unsigned int month, unsigned int day) {
+    year -= month <= 2;
+    int64_t era = floorDiv (year, 400);
+    unsigned int yearOfEra = (unsigned int)(year - era * 400);
+    unsigned int dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    unsigned int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    return era * 146097 + (int64_t)dayOfEra - 719468;
+}
+
+static const uint8_t daysInMonth[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+
+  /**
+    * @brief Parses an abbreviation. It may be alphabetic or quoted between `<` and `>`
+    * @param tz String position. It is advanced after abbreviation
+    * @param name Storage for abbreviation
+    * @return `false` if abbreviation is not valid
+    */
+static bool parseName (const char** tz, char* name) {
+    const char* p = *tz;
+    const char* start;
+    size_t length;
+
+    if (*p == '<') {
+        start = ++p;
+        while (*p && *p != '>') {
+            p++;
+        }
+        if (*p != '>') {
+            return false;
+        }
+        length = p++ - start;
+    } else {
+        start = p;
+        while (isalpha (*p)) {
+            p++;
+        }
+        length = p - start;
+    }
+    if (length < 3 || length >= TZ_ABBREVIATION_LENGTH) {
+        return false;
+    }
+    memcpy (name, start, length);
+    name[length] = '\0';
+    *tz = p;
+    return true;
+}
+
+  /**
+    * @brief Parses an unsigned decimal number
+    * @param tz String position. It is advanced after number
+    * @param value Storage for number
+    * @return `false` if there is no number
+    */
+static bool parseNumber (const char** tz, int32_t* value) {
+    const char* p = *tz;
+    int32_t number = 0;
+
+    if (!isdigit (*p)) {
+        return false;
+    }
+    while (isdigit (*p) && number < 100000) {
+        number = number * 10 + (*p++ - '0');
+    }
+    *value = number;
+    *tz = p;
+    return true;
+}
+
+  /**
+    * @brief Parses a signed `hh[:mm[:ss]]` time
+    * @param tz String position. It is advanced after time
+    * @param seconds Storage for time in seconds
+    * @param maxHours Maximum absolute number of hours
+    * @return `false` if time is not valid
+    */
+static bool parseTime (const char** tz, int32_t* seconds, int32_t maxHours) {
+    const char* p = *tz;
+    int32_t sign = 1;
+    int32_t hours, minutes = 0, secs = 0;
+
+    if (*p == '+' || *p == '-') {
+        sign = *p++ == '-' ? -1 : 1;
+    }
+    if (!parseNumber (&p, &hours) || hours > maxHours) {
+        return false;
+    }
+    if (*p == ':') {
+        p++;
+        if (!parseNumber (&p, &minutes) || minutes > 59) {
+            return false;
+        }
+        if (*p == ':') {
+            p++;
+            if (!parseNumber (&p, &secs) || secs > 59) {
+                return false;
+            }
+        }
+    }
+    *seconds = sign * (hours * SECONDS_PER_HOUR + minutes * 60 + secs);
+    *tz = p;
+    return true;
+}
+
+  /**
+    * @brief Parses a `,date[/time]` DST transition rule
+    * @param tz String position. It is advanced after rule
+    * @param rule Storage for rule
+    * @return `false` if rule is not valid
+    */
+static bool parseRule (const char** tz, TZRule_t* rule) {
+    const char* p = *tz;
+    int32_t value;
+
+    if (*p++ != ',') {
+        return false;
+    }
+    if (*p == 'M') {
+        int32_t week, weekDay;
+        p++;
+        if (!parseNumber (&p, &value) || value < 1 || value > 12 || *p++ != '.'
+            || !parseNumber (&p, &week) || week < 1 || week > 5 || *p++ != '.'
+            || !parseNumber (&p, &weekDay) || weekDay > 6) {
+            return false;
+        }
+        rule->type = monthWeekDay;
+        rule->month = value;
+        rule->week = week;
+        rule->day = weekDay;
+    } else if (*p == 'J') {
+        p++;
+        if (!parseNumber (&p, &value) || value < 1 || value > 365) {
+            return false;
+        }
+        rule->type = julianNoLeap;
+        rule->day = value;
+    } else {
+        if (!parseNumber (&p, &value) || value > 365) {
+            return false;
+        }
+        rule->type = julianLeap;
+        rule->day = value;
+    }
+    rule->time = DEFAULT_DST_TIME;
+    if (*p == '/') {
+        p++;
+        if (!parseTime (&p, &rule->time, MAX_RULE_TIME / SECONDS_PER_HOUR)) {
+            return false;
+        }
+    }
+    *tz = p;
+    return true;
+}
+
+  /**
+    * @brief Gets day of year when a rule applies
+    * @param rule DST transition rule
+    * @param year Year
+    * @return Day of year, 0 based
+    */
+static int ruleDayOfYear (const TZRule_t* rule, int year) {
+    bool leap = isLeapYear (year);
+
+    switch (rule->type) {
+    case julianNoLeap:
+        return rule->day - 1 + (leap && rule->day >= 60 ? 1 : 0);
+    case julianLeap:
+        return rule->day;
+    default:
+        break;
+    }
+
+    int64_t monthStart = daysFromCivil (year, rule->month, 1);
+    int firstOfMonth = (int)(monthStart - daysFromCivil (year, 1, 1));
+    int monthLength = daysInMonth[rule->month - 1] + (leap && rule->month == 2 ? 1 : 0);
+    int firstWeekDay = (int)(monthStart + 4 - floorDiv (monthStart + 4, 7) * 7); // 1-Jan-1970 was Thursday
+    int day = (rule->day - firstWeekDay + 7) % 7 + (rule->week - 1) * 7;
+    while (day >= monthLength) { // Week 5 means last one
+        day -= 7;
+    }
+    return firstOfMonth + day;
+}
+
+  /**
+    * @brief Converts seconds since 1-Jan-1970 to a time breakdown. Local time may be out of `time_t` range
+    */
+static tm* breakDownSeconds (int64_t moment, tm* result) {
+    int64_t days = floorDiv (moment, SECONDS_PER_DAY);
+    int32_t seconds = (int32_t)(moment - days * SECONDS_PER_DAY);
+
+    result->tm_hour = seconds / SECONDS_PER_HOUR;
+    result->tm_min = seconds / 60 % 60;
+    result->tm_sec = seconds % 60;
+    result->tm_wday = (int)(days + 4 - floorDiv (days + 4, 7) * 7); // 1-Jan-1970 was Thursday
+
+    // Civil from days, by Howard Hinnant
+    int64_t shifted = days + 719468;
+    int64_t era = floorDiv (shifted, 146097);
+    unsigned int dayOfEra = (unsigned int)(shifted - era * 146097);
+    unsigned int yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    unsigned int dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    unsigned int monthIndex = (5 * dayOfYear + 2) / 153;
+    unsigned int month = monthIndex < 10 ? monthIndex + 3 : monthIndex - 9;
+    int year = (int)(yearOfEra + era * 400) + (month <= 2);
+
+    result->tm_mday = dayOfYear - (153 * monthIndex + 2) / 5 + 1;
+    result->tm_mon = month - 1;
+    result->tm_year = year - 1900;
+    result->tm_yday = (int)(days - daysFromCivil (year, 1, 1));
+    result->tm_isdst = 0;
+    return result;
+}
+
+TimeZone::TimeZone () {
+    memset (&rules, 0, sizeof (rules));
+    strcpy (rules.stdName, "UTC");
+    strcpy (rules.dstName, "UTC");
+}
+
+TimeZone::TimeZone (const char* tz) : TimeZone () {
+    setRules (tz);
+}
+
+bool TimeZone::setRules (const char* tz, int firstYear) {
+    char buffer[TZ_STRING_LENGTH + 1];
+    TZRules_t parsed;
+    const char* p = buffer;
+
+    if (!tz) {
+        return false;
+    }
+    strncpy_P (buffer, tz, TZ_STRING_LENGTH); // Values in TZ.h are stored in flash on ESP8266
+    buffer[TZ_STRING_LENGTH] = '\0';
+
+    memset (&parsed, 0, sizeof (parsed));
+    if (!parseName (&p, parsed.stdName) || !parseTime (&p, &parsed.stdOffset, 24)) {
+        return false;
+    }
+    parsed.stdOffset = -parsed.stdOffset; // POSIX offsets are positive west of Greenwich
+    strcpy (parsed.dstName, parsed.stdName);
+    parsed.dstOffset = parsed.stdOffset;
+
+    if (*p) {
+        if (!parseName (&p, parsed.dstName)) {
+            return false;
+        }
+        parsed.hasDst = true;
+        parsed.dstOffset = parsed.stdOffset + SECONDS_PER_HOUR;
+        if (*p && *p != ',') {
+            if (!parseTime (&p, &parsed.dstOffset, 24)) {
+                return false;
+            }
+            parsed.dstOffset = -parsed.dstOffset;
+        }
+        if (*p) {
+            if (!parseRule (&p, &parsed.dstStart) || !parseRule (&p, &parsed.dstEnd) || *p) {
+                return false;
+            }
+        } else { // No rules, use US ones as newlib does
+            parsed.dstStart = { monthWeekDay, 0, 2, 3, DEFAULT_DST_TIME };
+            parsed.dstEnd = { monthWeekDay, 0, 1, 11, DEFAULT_DST_TIME };
+        }
+    }
+
+    rules = parsed;
+    buildTransitions (firstYear);
+    return true;
+}
+
+void TimeZone::getTransitions (int year, int64_t* start, int64_t* end) const {
+    int64_t yearStart = daysFromCivil (year, 1, 1) * SECONDS_PER_DAY;
+
+    // Rule times are local, in time that is in effect before transition
+    *start = yearStart + (int64_t)ruleDayOfYear (&rules.dstStart, year) * SECONDS_PER_DAY
+             + rules.dstStart.time - rules.stdOffset;
+    *end = yearStart + (int64_t)ruleDayOfYear (&rules.dstEnd, year) * SECONDS_PER_DAY
+           + rules.dstEnd.time - rules.dstOffset;
+}
+
+void TimeZone::buildTransitions (int firstYear) {
+    numTransitions = 0;
+    windowEnd = daysFromCivil (firstYear + TZ_TRANSITION_YEARS, 1, 1) * SECONDS_PER_DAY - rules.stdOffset;
+    if (!rules.hasDst) {
+        return;
+    }
+
+    for (int year = firstYear; year < firstYear + TZ_TRANSITION_YEARS; year++) {
+        int64_t start, end;
+        getTransitions (year, &start, &end);
+        if (start > MAX_TIME_T || end > MAX_TIME_T) { // Later years are calculated on every conversion
+            windowEnd = daysFromCivil (year, 1, 1) * SECONDS_PER_DAY - rules.stdOffset;
+            break;
+        }
+        // Southern hemisphere zones end DST earlier in year than they start it. Order is the same every year
+        firstTransitionDst = start < end;
+        transitions[numTransitions++] = (time_t)(firstTransitionDst ? start : end);
+        transitions[numTransitions++] = (time_t)(firstTransitionDst ? end : start);
+    }
+}
+
+bool TimeZone::isDst (time_t moment) const {
+    if (!rules.hasDst) {
+        return false;
+    }
+
+    if (numTransitions && moment >= transitions[0] && moment < windowEnd) {
+        int low = 0;
+        int high = numTransitions - 1;
+        while (low < high) { // Last transition not after moment
+            int middle = (low + high + 1) / 2;
+            if (transitions[middle] <= moment) {
+                low = middle;
+            } else {
+                high = middle - 1;
+            }
+        }
+        return ((low & 1) == 0) == firstTransitionDst;
+    }
+
+    // Out of precomputed window
+    int64_t start, end;
+    tm local;
+    breakDownSeconds ((int64_t)moment + rules.stdOffset, &local);
+    getTransitions (local.tm_year + 1900, &start, &end);
+    if (start < end) {
+        return moment >= start && moment < end;
+    } else {
+        return !(moment >= end && moment < start);
+    }
+}
+
+tm* TimeZone::localTime (time_t moment, tm* result) const {
+    bool dst = isDst (moment);
+    breakDownSeconds ((int64_t)moment + (dst ? rules.dstOffset : rules.stdOffset), result);
+    result->tm_isdst = dst ? 1 : 0;
+    return result;
+}
+
+tm* TimeZone::breakDown (time_t moment, tm* result) {
+    return breakDownSeconds (moment, result);
+}
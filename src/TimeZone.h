@@ -0,0 +1,152 @@
+/**
+  * @file TimeZone.h
+  * @version 0.2.6
+  * @date 29/12/2021
+  * @author German Martin
+  * @brief Time zone rules compiled from a POSIX TZ string, for local time conversion without `setenv` nor `tzset`
+  */
+
+#ifndef _TimeZone_h
+#define _TimeZone_h
+
+#include <stdint.h>
+#include <time.h>
+
+constexpr auto TZ_STRING_LENGTH = 60; ///< @brief Max POSIX TZ string length
+constexpr auto TZ_ABBREVIATION_LENGTH = 8; ///< @brief Max time zone abbreviation length, including terminating zero
+constexpr auto TZ_TRANSITION_YEARS = 20; ///< @brief Number of years whose DST transitions are precomputed
+constexpr auto DEFAULT_TZ_FIRST_YEAR = 2020; ///< @brief First year of precomputed DST transitions
+constexpr auto DEFAULT_DST_TIME = 7200; ///< @brief Default local time for DST transitions, in seconds after midnight
+
+  /**
+    * @brief Kinds of DST transition rules on a POSIX TZ string
+    */
+typedef enum {
+    julianNoLeap,                   ///< @brief `Jn`. Day of year 1-365, February 29th is never counted
+    julianLeap,                     ///< @brief `n`. Day of year 0-365, February 29th is counted
+    monthWeekDay                    ///< @brief `Mm.w.d`. Day `d` of week `w` of month `m`. Week 5 means last one
+} TZRuleType_t;
+
+  /**
+    * @brief Rule for a DST transition
+    */
+typedef struct {
+    TZRuleType_t type;              ///< @brief How day is given
+    uint16_t day;                   ///< @brief Day of year for julian rules, day of week (0 = Sunday) for month rules
+    uint8_t week;                   ///< @brief Week of month, 1-5
+    uint8_t month;                  ///< @brief Month, 1-12
+    int32_t time;                   ///< @brief Local time when transition happens, in seconds after midnight. May be negative or over 24 hours
+} TZRule_t;
+
+  /**
+    * @brief Time zone rules as described by a POSIX TZ string
+    */
+typedef struct {
+    int32_t stdOffset;              ///< @brief Standard time offset, in seconds east of UTC
+    int32_t dstOffset;              ///< @brief Daylight saving time offset, in seconds east of UTC
+    bool hasDst;                    ///< @brief `true` if time zone has daylight saving time
+    TZRule_t dstStart;              ///< @brief Transition from standard to daylight saving time
+    TZRule_t dstEnd;                ///< @brief Transition from daylight saving to standard time
+    char stdName[TZ_ABBREVIATION_LENGTH];  ///< @brief Standard time abbreviation
+    char dstName[TZ_ABBREVIATION_LENGTH];  ///< @brief Daylight saving time abbreviation
+} TZRules_t;
+
+  /**
+    * @brief Local time zone. POSIX TZ string is parsed once and DST transitions for `TZ_TRANSITION_YEARS`
+    * years are precomputed, so conversion is a binary search and an add. Several objects may coexist without
+    * touching `TZ` environment variable, which stays managed by `NTP.setTimeZone()`
+    */
+class TimeZone {
+protected:
+    TZRules_t rules;                ///< @brief Compiled time zone rules
+    time_t transitions[TZ_TRANSITION_YEARS * 2]; ///< @brief UNIX time of DST transitions, sorted. DST starts and ends alternate
+    uint8_t numTransitions = 0;     ///< @brief Number of valid items in `transitions`
+    bool firstTransitionDst = false; ///< @brief `true` if first transition starts DST
+    int64_t windowEnd = 0;          ///< @brief UNIX time when last year of `transitions` ends
+
+    /**
+      * @brief Calculates DST transitions of a year
+      * @param year Year
+      * @param[out] start UNIX time when DST starts. It may not fit on a 32 bit `time_t`
+      * @param[out] end UNIX time when DST ends. It may not fit on a 32 bit `time_t`
+      */
+    void getTransitions (int year, int64_t* start, int64_t* end) const;
+
+    /**
+      * @brief Fills transition table for `TZ_TRANSITION_YEARS` years. With a 32 bit `time_t` table stops on
+      * last year whose transitions fit on it
+      * @param firstYear First year in table
+      */
+    void buildTransitions (int firstYear);
+
+public:
+    /**
+      * @brief Creates a time zone set to UTC
+      */
+    TimeZone ();
+
+    /**
+      * @brief Creates a time zone from a POSIX TZ string. Falls back to UTC if it is not valid
+      * @param tz POSIX TZ string, like values in `TZdef.h`. It is copied, so it may be a temporary buffer
+      */
+    TimeZone (const char* tz);
+
+    /**
+      * @brief Parses a POSIX TZ string and precomputes its DST transitions
+      * @param tz POSIX TZ string, like `CET-1CEST,M3.5.0,M10.5.0/3`. It is copied, so it may be a temporary buffer
+      * @param firstYear First year whose transitions are precomputed. Other years are calculated on every conversion
+      * @return `false` if string is not valid. Time zone is not changed in that case
+      */
+    bool setRules (const char* tz, int firstYear = DEFAULT_TZ_FIRST_YEAR);
+
+    /**
+      * @brief Gets compiled time zone rules
+      * @return Time zone rules
+      */
+    const TZRules_t* getRules () const {
+        return &rules;
+    }
+
+    /**
+      * @brief Checks if daylight saving time is in effect at a given time
+      * @param moment `time_t` value (UNIX time)
+      * @return `true` if daylight saving time is in effect
+      */
+    bool isDst (time_t moment) const;
+
+    /**
+      * @brief Gets offset from UTC at a given time
+      * @param moment `time_t` value (UNIX time)
+      * @return Offset in seconds east of UTC
+      */
+    int32_t getOffset (time_t moment) const {
+        return isDst (moment) ? rules.dstOffset : rules.stdOffset;
+    }
+
+    /**
+      * @brief Gets time zone abbreviation at a given time
+      * @param moment `time_t` value (UNIX time)
+      * @return Abbreviation, like `CET` or `CEST`
+      */
+    const char* getAbbreviation (time_t moment) const {
+        return isDst (moment) ? rules.dstName : rules.stdName;
+    }
+
+    /**
+      * @brief Converts a time to local time breakdown on this time zone, as `localtime_r` does
+      * @param moment `time_t` value (UNIX time) to convert
+      * @param result Storage for local time breakdown
+      * @return `result`
+      */
+    tm* localTime (time_t moment, tm* result) const;
+
+    /**
+      * @brief Converts a time to UTC breakdown, as `gmtime_r` does
+      * @param moment `time_t` value (UNIX time) to convert
+      * @param result Storage for time breakdown
+      * @return `result`
+      */
+    static tm* breakDown (time_t moment, tm* result);
+};
+
+#endif // _TimeZone_h
@@ -0,0 +1,110 @@
+#!/usr/bin/env python3
+"""Decodes trace records dumped by ntpTraceDump() when library is built with NTP_TRACE.
+
+Reads a serial log, which may contain other output, and prints every record
+with its time relative to first one, followed by a summary of time spent on
+every sync stage.
+
+Times come from a microsecond clock shared by all cores, stored in 32 bits, so
+gaps between records longer than 35 minutes are not valid. A record older than
+the previous one means that its writer was preempted between claiming a slot and
+reading the clock. It is reported and left out of stage times.
+
+Usage: NTPTraceDecode.py [log file]    (standard input if not given)
+"""
+
+import sys
+
+EVENTS = {
+    1: ("pollStart", ("servers", "burst")),
+    2: ("dnsStart", ("server", None)),
+    3: ("dnsDone", ("server", "resolved")),
+    4: ("sendStart", ("server", None)),
+    5: ("sendDone", ("server", "error")),
+    6: ("receive", ("length", "port")),
+    7: ("processStart", ("length", None)),
+    8: ("decoded", ("valid", None)),
+    9: ("matched", ("server", None)),
+    10: ("offset", ("offset_us", "delay_us")),
+    11: ("adjustStart", ("offset_us", None)),
+    12: ("adjustDone", ("slewing", "ok")),
+    13: ("timeout", ("responses", None)),
+    14: ("syncDone", ("status", None)),
+}
+
+# Stages measured as time from first event to second one
+STAGES = (
+    ("dns", 2, 3),
+    ("send", 4, 5),
+    ("network", 5, 6),
+    ("dispatch", 6, 7),
+    ("decode+match", 7, 9),
+    ("offset", 9, 10),
+    ("adjust", 11, 12),
+    ("poll to sync", 1, 14),
+)
+
+
+def parse(lines):
+    found = False
+    records = []
+    for line in lines:
+        fields = line.split()
+        if len(fields) >= 3 and fields[0].endswith("NTPTRACE") and fields[1] == "US":
+            found = True
+            records = []  # Only last dump is decoded
+        elif len(fields) >= 6 and fields[0].endswith("NTPT"):
+            try:
+                records.append((int(fields[1], 16), int(fields[2], 16), int(fields[3], 16),
+                                int(fields[4]), int(fields[5])))
+            except ValueError:
+                pass  # Line mixed with other output
+    return found, records
+
+
+def main():
+    source = open(sys.argv[1]) if len(sys.argv) > 1 else sys.stdin
+    found, records = parse(source)
+    if not found or not records:
+        sys.exit("No trace found")
+
+    elapsed = 0
+    previous = records[0][1]
+    timeline = []
+    errors = 0
+    print("%12s %10s  %-13s %s" % ("time us", "delta us", "event", "args"))
+    for sequence, micros, event, arg0, arg1 in records:
+        delta = (micros - previous) & 0xFFFFFFFF  # Clock wraps around
+        if delta >= 0x80000000:
+            delta -= 0x100000000
+        name, arg_names = EVENTS.get(event, ("event%d" % event, ("arg0", "arg1")))
+        args = ["%s=%d" % (arg_name, value) for arg_name, value in zip(arg_names, (arg0, arg1)) if arg_name]
+        if delta < 0:
+            errors += 1
+            print("%12s %10d  %-13s %s  OUT OF ORDER" % ("", delta, name, " ".join(args)))
+            continue
+        previous = micros
+        elapsed += delta
+        timeline.append((elapsed, event))
+        print("%12d %10d  %-13s %s" % (elapsed, delta, name, " ".join(args)))
+    if errors:
+        print("%d records out of order" % errors)
+
+    print()
+    print("%-14s %6s %10s %10s %10s" % ("stage", "count", "min us", "avg us", "max us"))
+    for stage, start_event, end_event in STAGES:
+        durations = []
+        start = None
+        for time, event in timeline:
+            if event == start_event:
+                start = time
+            elif event == end_event and start is not None:
+                durations.append(time - start)
+                start = None
+        if durations:
+            print("%-14s %6d %10.1f %10.1f %10.1f" % (stage, len(durations), min(durations),
+                                                       sum(durations) / len(durations), max(durations)))
+
+
+if __name__ == "__main__":
+    main()
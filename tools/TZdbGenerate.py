@@ -0,0 +1,109 @@
+#!/usr/bin/env python3
+"""Generates src/TZdbData.h, the time zone table used by NTP.setTimeZoneByName().
+
+Source is the same zones.csv that TZdef.h is generated from. Zone names are
+sorted for binary search and POSIX strings shared by several zones are stored
+only once.
+
+Usage: TZdbGenerate.py [zones.csv path or URL] [output file]
+"""
+
+import csv
+import datetime
+import io
+import os
+import sys
+import urllib.request
+
+DEFAULT_SOURCE = "https://raw.githubusercontent.com/nayarsystems/posix_tz_db/master/zones.csv"
+DEFAULT_OUTPUT = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "src", "TZdbData.h")
+
+
+def read_zones(source):
+    if source.startswith("http://") or source.startswith("https://"):
+        with urllib.request.urlopen(source) as response:
+            text = response.read().decode("utf-8")
+    else:
+        with open(source, encoding="utf-8") as f:
+            text = f.read()
+    zones = {}
+    for row in csv.reader(io.StringIO(text)):
+        if len(row) != 2:
+            continue
+        zones[row[0]] = row[1]
+    return zones
+
+
+def c_string(text):
+    return '"' + text.replace("\\", "\\\\").replace('"', '\\"') + '\\0"'
+
+
+def main():
+    source = sys.argv[1] if len(sys.argv) > 1 else DEFAULT_SOURCE
+    output = sys.argv[2] if len(sys.argv) > 2 else DEFAULT_OUTPUT
+
+    zones = read_zones(source)
+    names = sorted(zones, key=lambda name: name.encode("utf-8"))  # Same order as strcmp
+
+    rules = []
+    rule_offsets = {}
+    rule_pool_size = 0
+    for name in names:
+        rule = zones[name]
+        if rule not in rule_offsets:
+            rule_offsets[rule] = rule_pool_size
+            rules.append(rule)
+            rule_pool_size += len(rule) + 1
+
+    name_offsets = []
+    name_pool_size = 0
+    for name in names:
+        name_offsets.append(name_pool_size)
+        name_pool_size += len(name) + 1
+
+    if max(name_pool_size, rule_pool_size) > 0xFFFF:
+        sys.exit("Table too big for 16 bit offsets")
+
+    index_size = len(names) * 4
+    total = name_pool_size + rule_pool_size + index_size
+
+    lines = []
+    lines.append("// autogenerated from %s" % source)
+    lines.append("// by script tools/TZdbGenerate.py")
+    lines.append("// %s" % datetime.datetime.utcnow().strftime("%a %b %d %H:%M:%S UTC %Y"))
+    lines.append("//")
+    lines.append("// %d zones, %d different rules. Flash usage: %d bytes" % (len(names), len(rules), total))
+    lines.append("//   names %d bytes, rules %d bytes, index %d bytes" % (name_pool_size, rule_pool_size, index_size))
+    lines.append("// Do not edit. Only to be included by TZdb.cpp")
+    lines.append("")
+    lines.append("#ifndef _TZdbData_h")
+    lines.append("#define _TZdbData_h")
+    lines.append("")
+    lines.append("constexpr auto TZDB_NUM_ZONES = %d; ///< @brief Number of zones in `tzdbZones`" % len(names))
+    lines.append("")
+    lines.append("static const char tzdbNames[] PROGMEM =")
+    for name in names:
+        lines.append("    " + c_string(name))
+    lines.append("    ;")
+    lines.append("")
+    lines.append("static const char tzdbRules[] PROGMEM =")
+    for rule in rules:
+        lines.append("    " + c_string(rule))
+    lines.append("    ;")
+    lines.append("")
+    lines.append("static const TZdbEntry_t tzdbZones[TZDB_NUM_ZONES] PROGMEM = {")
+    for name, offset in zip(names, name_offsets):
+        lines.append("    { %5d, %4d }, // %s" % (offset, rule_offsets[zones[name]], name))
+    lines.append("};")
+    lines.append("")
+    lines.append("#endif // _TZdbData_h")
+
+    with open(output, "w", encoding="utf-8", newline="\n") as f:
+        f.write("\n".join(lines) + "\n")
+
+    print("%d zones, %d different rules" % (len(names), len(rules)))
+    print("Flash usage: %d bytes (names %d, rules %d, index %d)" % (total, name_pool_size, rule_pool_size, index_size))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,19 @@
+/**
+  * @file Arduino.h
+  * @brief Minimal Arduino stub to build time zone code on a host computer. Flash is ordinary memory there,
+  * so PROGMEM access functions map to standard ones
+  */
+
+#ifndef _HostArduino_h
+#define _HostArduino_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define PROGMEM
+#define strcmp_P strcmp
+#define strncpy_P strncpy
+#define pgm_read_word(address) (*(const uint16_t*)(address))
+
+#endif // _HostArduino_h
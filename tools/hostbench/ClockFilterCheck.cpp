@@ -0,0 +1,53 @@
+/**
+  * @file ClockFilterCheck.cpp
+  * @brief Host check of RFC5905 clock filter sample selection
+  *
+  * Build and run from repository root:
+  *
+  *     g++ -O2 -std=gnu++11 -Isrc tools/hostbench/ClockFilterCheck.cpp src/ClockFilter.cpp -o clockfiltercheck
+  *     ./clockfiltercheck
+  */
+
+#include "ClockFilter.h"
+#include <stdio.h>
+
+constexpr auto POLL_US = 64000000LL; // 64 s between samples
+
+static long errors = 0;
+
+static void check (bool condition, const char* message) {
+    if (!condition) {
+        printf ("FAIL: %s\n", message);
+        errors++;
+    }
+}
+
+int main () {
+    NTPSample_t samples[CLOCK_FILTER_SIZE];
+    int64_t now = 10 * POLL_US;
+
+    // Newest sample has a long delay, older ones a short one
+    samples[0] = { 9000000, 40000000, 0, now, 0 };
+    samples[1] = { 1000000, 2000000, 0, now - POLL_US, 0 };
+    samples[2] = { 1200000, 3000000, 0, now - 2 * POLL_US, 0 };
+    check (selectClockFilterSample (samples, 3, now) == 1, "older low delay sample has to beat newer high delay one");
+    check (selectClockFilterSample (samples, 1, now) == 0, "only sample has to be selected");
+
+    // Same delay, newer sample wins because of aging
+    samples[0].delay = 2000000;
+    check (selectClockFilterSample (samples, 2, now) == 0, "newer sample has to win on same delay");
+
+    // 500 us were stepped after sample 1 and slewed before sample 0 was got
+    samples[0] = { 100000, 2000000, 0, now, 500 };
+    samples[1] = { 600000, 2000000, 0, now - POLL_US, 0 };
+    check (clockFilterOffset (&samples[1], 500) == 100000, "older offset has to be referred to current clock");
+    check (clockFilterOffset (&samples[0], 500) == 100000, "newer offset must not change");
+    check (clockFilterJitter (samples, 2, 0, 500) == 0, "applied correction must not add jitter");
+    check (clockFilterJitter (samples, 1, 0, 500) == 0, "single sample has no jitter");
+
+    samples[1].offset = 700000;
+    check (clockFilterJitter (samples, 2, 0, 500) == 100000, "jitter has to be difference between samples");
+
+    printf ("%ld clock filter errors\n", errors);
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,99 @@
+/**
+  * @file TZdbBench.cpp
+  * @brief Host check and benchmark of `findTimeZone()`
+  *
+  * Build and run from repository root:
+  *
+  *     g++ -O2 -std=gnu++11 -DARDUINO=10800 -Itools/hostbench -Isrc tools/hostbench/TZdbBench.cpp src/TZdb.cpp -o tzdbbench
+  *     ./tzdbbench [zones.csv]
+  *
+  * Every zone on the table is looked up by name. If the zones.csv that `TZdbData.h` was generated from is
+  * given, every zone on it has to resolve to the same POSIX string.
+  */
+
+#include "Arduino.h"
+#include "TZdb.h"
+#include "TZdbData.h"
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+
+constexpr auto BENCH_ROUNDS = 2000;
+constexpr auto CSV_LINE_LENGTH = 256;
+
+static volatile uintptr_t sink; // Keeps benchmark loop from being optimized out
+
+static const char* zoneName (int index) {
+    return tzdbNames + pgm_read_word (&(tzdbZones[index].name));
+}
+
+static long checkTable () {
+    long errors = 0;
+
+    for (int i = 0; i < TZDB_NUM_ZONES; i++) {
+        const char* rule = findTimeZone (zoneName (i));
+        if (!rule || strcmp (rule, tzdbRules + pgm_read_word (&(tzdbZones[i].rule)))) { // Table is a copy of library one
+            printf ("%s: wrong entry\n", zoneName (i));
+            errors++;
+        }
+    }
+    if (findTimeZone ("Europe/Nowhere") || findTimeZone ("") || findTimeZone (NULL)) {
+        printf ("Unknown name found\n");
+        errors++;
+    }
+    return errors;
+}
+
+static long checkCsv (const char* path) {
+    FILE* file = fopen (path, "r");
+    char line[CSV_LINE_LENGTH];
+    long errors = 0;
+    int zones = 0;
+
+    if (!file) {
+        printf ("Cannot open %s\n", path);
+        return 1;
+    }
+    // Lines are "name","rule"
+    while (fgets (line, sizeof (line), file)) {
+        char* name = strchr (line, '"');
+        char* separator = name ? strstr (name + 1, "\",\"") : NULL;
+        char* end = separator ? strrchr (separator + 3, '"') : NULL;
+        if (!end) {
+            continue;
+        }
+        name++;
+        *separator = '\0';
+        *end = '\0';
+        const char* rule = findTimeZone (name);
+        if (!rule || strcmp (rule, separator + 3)) {
+            printf ("%s: expected %s, got %s\n", name, separator + 3, rule ? rule : "NULL");
+            errors++;
+        }
+        zones++;
+    }
+    fclose (file);
+    printf ("%d zones checked from %s\n", zones, path);
+    return errors;
+}
+
+int main (int argc, char** argv) {
+    long errors = checkTable ();
+    if (argc > 1) {
+        errors += checkCsv (argv[1]);
+    }
+    printf ("%ld lookup errors\n", errors);
+
+    uintptr_t check = 0;
+    auto start = std::chrono::steady_clock::now ();
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        for (int i = 0; i < TZDB_NUM_ZONES; i++) {
+            check += (uintptr_t)findTimeZone (zoneName (i));
+        }
+    }
+    auto end = std::chrono::steady_clock::now ();
+    sink = check;
+    double lookup = std::chrono::duration<double, std::nano> (end - start).count () / ((double)BENCH_ROUNDS * TZDB_NUM_ZONES);
+    printf ("%d zones: %.0f ns per lookup\n", TZDB_NUM_ZONES, lookup);
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,112 @@
+/**
+  * @file TimeZoneBench.cpp
+  * @brief Host check and benchmark of `TimeZone` against glibc `localtime_r`
+  *
+  * Build and run from repository root:
+  *
+  *     g++ -O2 -std=gnu++11 -DARDUINO=10800 -Itools/hostbench -Isrc tools/hostbench/TimeZoneBench.cpp src/TimeZone.cpp -o tzbench
+  *     ./tzbench
+  *
+  * glibc applies its `posixrules` file to TZ strings without rules, like `EST5EDT`, so those zones are
+  * not compared. Times depend on host, only ratio between both conversions is meaningful.
+  */
+
+#include "TimeZone.h"
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char* const zones[] = {
+    "CET-1CEST,M3.5.0,M10.5.0/3",
+    "EST5EDT,M3.2.0,M11.1.0",
+    "AEST-10AEDT,M10.1.0,M4.1.0/3",
+    "<+1030>-10:30<+11>-11,M10.1.0,M4.1.0",
+    "IST-5:30",
+    "<-03>3<-02>,M3.5.0/-2,M10.5.0/-1",
+    "NZST-12NZDT,M9.5.0,M4.1.0/3",
+    "GMT0BST,M3.5.0/1,M10.5.0",
+    "<+0330>-3:30<+0430>,J79/24,J263/24"
+};
+
+constexpr auto CHECK_START = 0LL;           // 1-Jan-1970
+constexpr auto CHECK_END = 4000000000LL;    // 2096
+constexpr auto BENCH_START = 1600000000LL;  // Sep 2020
+constexpr auto BENCH_STEP = 37;
+constexpr auto BENCH_SAMPLES = 2000000;
+
+static bool sameTime (const tm* a, const tm* b) {
+    return a->tm_sec == b->tm_sec && a->tm_min == b->tm_min && a->tm_hour == b->tm_hour
+        && a->tm_mday == b->tm_mday && a->tm_mon == b->tm_mon && a->tm_year == b->tm_year
+        && a->tm_wday == b->tm_wday && a->tm_yday == b->tm_yday && a->tm_isdst == b->tm_isdst;
+}
+
+static long checkZone (const char* tz) {
+    TimeZone zone;
+    long errors = 0;
+
+    if (!zone.setRules (tz)) {
+        printf ("%s: parse error\n", tz);
+        return 1;
+    }
+    setenv ("TZ", tz, 1);
+    tzset ();
+    // Coarse steps over whole range, then 10 minute steps around precomputed window
+    for (long long moment = CHECK_START; moment < CHECK_END; moment += 1234567 + (moment & 1023)) {
+        time_t t = (time_t)moment;
+        tm expected, got;
+        localtime_r (&t, &expected);
+        zone.localTime (t, &got);
+        if (!sameTime (&expected, &got) && errors++ < 5) {
+            printf ("%s: mismatch at %lld\n", tz, moment);
+        }
+    }
+    for (long long moment = BENCH_START; moment < BENCH_START + 300000000LL; moment += 599) {
+        time_t t = (time_t)moment;
+        tm expected, got;
+        localtime_r (&t, &expected);
+        zone.localTime (t, &got);
+        if (!sameTime (&expected, &got) && errors++ < 5) {
+            printf ("%s: mismatch at %lld\n", tz, moment);
+        }
+    }
+    return errors;
+}
+
+static void benchmark (const char* tz) {
+    TimeZone zone (tz);
+    tm result;
+    long check = 0;
+
+    setenv ("TZ", tz, 1);
+    tzset ();
+    auto start = std::chrono::steady_clock::now ();
+    for (long i = 0; i < BENCH_SAMPLES; i++) {
+        time_t t = (time_t)(BENCH_START + i * BENCH_STEP);
+        localtime_r (&t, &result);
+        check += result.tm_hour;
+    }
+    auto middle = std::chrono::steady_clock::now ();
+    for (long i = 0; i < BENCH_SAMPLES; i++) {
+        time_t t = (time_t)(BENCH_START + i * BENCH_STEP);
+        zone.localTime (t, &result);
+        check -= result.tm_hour;
+    }
+    auto end = std::chrono::steady_clock::now ();
+
+    double system = std::chrono::duration<double, std::nano> (middle - start).count () / BENCH_SAMPLES;
+    double own = std::chrono::duration<double, std::nano> (end - middle).count () / BENCH_SAMPLES;
+    printf ("%s: localtime_r %.0f ns, TimeZone %.0f ns (%.0f%%)%s\n", tz, system, own, own * 100.0 / system,
+            check ? " RESULTS DIFFER" : "");
+}
+
+int main () {
+    long errors = 0;
+
+    for (const char* tz : zones) {
+        errors += checkZone (tz);
+    }
+    printf ("%ld conversion errors\n", errors);
+    benchmark (zones[0]);
+    return errors ? 1 : 0;
+}